@@ -0,0 +1,406 @@
+// Host benchmark suite for the preset parsing, dispatch and storage paths.
+// Build and run with: pio run -e bench && .pio/build/bench/program [output.jsonl]
+// Every result is printed as one JSON object per line so runs can be diffed or compared by script.
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "picomod.h"
+#include "presetbank.h"
+#include "actionpool.h"
+#include "host.h"
+
+#define BENCH_MIN_SAMPLE_NS	20000000ULL		// Each sample runs for at least 20ms
+#define BENCH_SAMPLES			7
+
+typedef struct
+{
+	std::string name;
+	uint64_t iterations;
+	double nsPerOp;		// Median of the samples
+	double nsPerOpMin;
+	uint64_t bytesPerOp;
+} BenchResult;
+
+static std::vector<BenchResult> results;
+static FILE* output = stdout;
+
+// Output capture
+static std::string serialCapture;
+static bool captureSerial = false;
+static uint64_t serialBytes;
+
+// Private Function Prototypes
+static void hostEventHandler(HostEventType type, const uint8_t* data, uint32_t len, uint32_t arg);
+static void bootDevice();
+static void fillRealisticPreset(Preset* p);
+static void fillWorstCasePreset(Preset* p);
+static void fillDispatchPreset(Preset* p, uint8_t numActions, bool midiOnly);
+static void storePreset(uint8_t index, Preset* p);
+static std::string capturePresetPacket(uint8_t index);
+template<typename F> static void runBenchmark(const std::string& name, uint64_t bytesPerOp, F fn);
+static void printResult(BenchResult* result);
+
+
+int main(int argc, char** argv)
+{
+	if(argc > 1)
+	{
+		output = fopen(argv[1], "w");
+		if(output == NULL)
+		{
+			fprintf(stderr, "Unable to open %s\n", argv[1]);
+			return 1;
+		}
+	}
+
+	host_SetEventHandler(hostEventHandler);
+	// Wire time is not what is being measured here
+	host_SetUartBaud(0);
+	bootDevice();
+
+	fprintf(output, "{\"suite\":\"picomod\",\"fwVersion\":%.1f,\"presetSize\":%u,\"globalConfigSize\":%u,\"numPresets\":%u}\n",
+			(double)FW_VERSION, (unsigned)sizeof(Preset), (unsigned)sizeof(GlobalConfig), (unsigned)NUM_PRESETS);
+
+	Preset realistic;
+	Preset worstCase;
+	fillRealisticPreset(&realistic);
+	fillWorstCasePreset(&worstCase);
+	storePreset(1, &realistic);
+	storePreset(2, &worstCase);
+
+	//------------ Preset packets ------------//
+	std::string realisticJson = capturePresetPacket(1);
+	std::string worstCaseJson = capturePresetPacket(2);
+	static char packet[JSON_RX_BUFFER_SIZE * 8];
+
+	// The parser works in place on the receive buffer, so the packet is copied in on every run
+	runBenchmark("processPresetPacket/realistic", realisticJson.size(), [&]()
+	{
+		memcpy(packet, realisticJson.c_str(), realisticJson.size() + 1);
+		processPresetPacket(packet);
+	});
+	runBenchmark("processPresetPacket/worstCase", worstCaseJson.size(), [&]()
+	{
+		memcpy(packet, worstCaseJson.c_str(), worstCaseJson.size() + 1);
+		processPresetPacket(packet);
+	});
+
+	globalConfig.currentPreset = 1;
+	readCurrentPreset();
+	runBenchmark("sendPresetPacket/realistic", realisticJson.size(), [&]()
+	{
+		sendPresetPacket(1);
+	});
+	globalConfig.currentPreset = 2;
+	readCurrentPreset();
+	runBenchmark("sendPresetPacket/worstCase", worstCaseJson.size(), [&]()
+	{
+		sendPresetPacket(2);
+	});
+
+	//------------ Trigger dispatch ------------//
+	const uint8_t actionCounts[] = {0, 1, 2, 4, 8, 16};
+	for(uint8_t midiOnly=0; midiOnly<2; midiOnly++)
+	{
+		for(uint8_t n : actionCounts)
+		{
+			Preset dispatch;
+			fillDispatchPreset(&dispatch, n, midiOnly);
+			storePreset(3, &dispatch);
+			goToPreset(3);
+			std::string name = std::string("processTriggers/") + (midiOnly ? "midi" : "mixed") + "/actions=" + std::to_string(n);
+			runBenchmark(name, 0, [&]()
+			{
+				processTriggerInput(TriggerSwitch1, ButtonPress, 127);
+				midiOut_Process();
+			});
+		}
+	}
+
+	//------------ USB MIDI ------------//
+	// A dense CC stream is released in full transfers rather than one packet per send
+	runBenchmark("usbMidi/ccStream/16", 16 * 4, [&]()
+	{
+		for(uint8_t i=0; i<16; i++)
+		{
+			midiOut_SendUsb(MidiCableLocal, midi::ControlChange, i, i, 1);
+		}
+	});
+	static uint8_t dump[MIDI_OUT_SYSEX_BUFFER_SIZE];
+	memset(dump, 0x55, sizeof(dump));
+	dump[0] = midi::SystemExclusive;
+	dump[sizeof(dump) - 1] = midi::SystemExclusiveEnd;
+	runBenchmark("usbMidi/sysEx", sizeof(dump), [&]()
+	{
+		midiOut_SendUsbSysEx(MidiCableTrsMirror, dump, sizeof(dump));
+		midiOut_Flush();
+	});
+
+	//------------ Storage ------------//
+	globalConfig.currentPreset = 1;
+	readCurrentPreset();
+	runBenchmark("readCurrentPreset", sizeof(Preset), [&]()
+	{
+		readCurrentPreset();
+	});
+	// Unchanged records are compared against flash and never written
+	runBenchmark("saveCurrentPreset/unchanged", sizeof(Preset), [&]()
+	{
+		saveCurrentPreset();
+	});
+	// A changed record costs a sector erase and the reprogramming of its pages
+	runBenchmark("saveCurrentPreset/changed", sizeof(Preset), [&]()
+	{
+		presetState.expValue ^= 1;
+		saveCurrentPreset();
+	});
+	runBenchmark("saveGlobalConfig", sizeof(GlobalConfig), [&]()
+	{
+		saveGlobalConfig();
+	});
+	// Neighbouring presets are resident and only swap the active pointer
+	runBenchmark("goToPreset/resident", sizeof(Preset), [&]()
+	{
+		goToPreset(globalConfig.currentPreset == 1 ? 2 : 1);
+	});
+	// Distant presets are read from flash and refill the window
+	runBenchmark("goToPreset/miss", sizeof(Preset), [&]()
+	{
+		goToPreset(globalConfig.currentPreset == 10 ? 100 : 10);
+		presetBank_Process();
+	});
+
+	//------------ Full bank ------------//
+	for(uint8_t i=0; i<NUM_PRESETS; i++)
+	{
+		storePreset(i, (i & 1) ? &worstCase : &realistic);
+	}
+	uint64_t bankBytes = 0;
+	for(uint8_t i=0; i<NUM_PRESETS; i++)
+	{
+		bankBytes += capturePresetPacket(i).size();
+	}
+	runBenchmark("bankSerialise", bankBytes, [&]()
+	{
+		for(uint8_t i=0; i<NUM_PRESETS; i++)
+		{
+			globalConfig.currentPreset = i;
+			readCurrentPreset();
+			sendPresetPacket(i);
+		}
+	});
+
+	for(BenchResult& result : results)
+	{
+		printResult(&result);
+	}
+	if(output != stdout)
+	{
+		fclose(output);
+	}
+	return 0;
+}
+
+
+//-------------------- Local Functions --------------------//
+static void hostEventHandler(HostEventType type, const uint8_t* data, uint32_t len, uint32_t arg)
+{
+	(void)arg;
+	if(type == HostEventSerial)
+	{
+		serialBytes += len;
+		if(captureSerial)
+		{
+			serialCapture.append((const char*)data, len);
+		}
+	}
+}
+
+// A blank device configures itself and requests a reset, the second init is the normal boot
+static void bootDevice()
+{
+	picoMod_Init();
+	if(host_ResetRequested())
+	{
+		host_ClearResetRequest();
+		picoMod_Init();
+	}
+}
+
+// Mirrors the kind of preset in docs/interface-example.json
+static void fillRealisticPreset(Preset* p)
+{
+	memset(p, 0, sizeof(Preset));
+	p->id = 1234;
+	p->expValue = 127;
+	p->bypassRelayState = 1;
+	p->numActions = 6;
+
+	p->actions[0].trigger.type = TriggerSwitch1;
+	p->actions[0].trigger.value.buttonTrigger = ButtonPress;
+	p->actions[0].type = ActionEventMidi;
+	p->actions[0].event.midiMessage = {1, MIDI_NAMESPACE::ControlChange, 60, 127, MidiDestTrs};
+
+	p->actions[1].trigger.type = TriggerEnterBank;
+	p->actions[1].type = ActionEventExp;
+	p->actions[1].event.expMessage.value = 196;
+
+	p->actions[2].trigger.type = TriggerCC;
+	p->actions[2].trigger.value.midiTrigger.midiNum = 60;
+	p->actions[2].trigger.value.midiTrigger.midiValue = 19;
+	p->actions[2].type = ActionEventOutput;
+	p->actions[2].event.outputMessage.target = OutputBypassRelay;
+	p->actions[2].event.outputMessage.value = OutputOn;
+
+	for(uint8_t i=3; i<p->numActions; i++)
+	{
+		p->actions[i].trigger.type = TriggerGpio4;
+		p->actions[i].trigger.value.buttonTrigger = ButtonPress;
+		p->actions[i].type = ActionEventLed;
+		p->actions[i].event.ledMessage.index = i - 2;
+		p->actions[i].event.ledMessage.colour = 0x1f123d;
+	}
+}
+
+// Every action slot used, with the widest values of each field
+static void fillWorstCasePreset(Preset* p)
+{
+	memset(p, 0, sizeof(Preset));
+	p->id = 0xFFFFFFFF;
+	p->expValue = 256;
+	p->numActions = NUM_SWITCH_ACTIONS;
+	for(uint8_t i=0; i<NUM_SWITCH_ACTIONS; i++)
+	{
+		p->actions[i].trigger.type = TriggerCC;
+		p->actions[i].trigger.value.midiTrigger.midiNum = 127;
+		p->actions[i].trigger.value.midiTrigger.midiValue = 127;
+		if(i & 1)
+		{
+			p->actions[i].type = ActionEventLed;
+			p->actions[i].event.ledMessage.index = NUM_LEDS - 1;
+			p->actions[i].event.ledMessage.colour = 0xFFFFFF;
+		}
+		else
+		{
+			p->actions[i].type = ActionEventMidi;
+			p->actions[i].event.midiMessage = {16, MIDI_NAMESPACE::ControlChange, 127, 127, MidiDestAll};
+		}
+	}
+}
+
+static void fillDispatchPreset(Preset* p, uint8_t numActions, bool midiOnly)
+{
+	memset(p, 0, sizeof(Preset));
+	p->numActions = numActions;
+	for(uint8_t i=0; i<numActions; i++)
+	{
+		Action* action = &p->actions[i];
+		action->trigger.type = TriggerSwitch1;
+		action->trigger.value.buttonTrigger = ButtonPress;
+		switch(midiOnly ? 0 : i % 4)
+		{
+			case 0:
+			action->type = ActionEventMidi;
+			action->event.midiMessage = {1, MIDI_NAMESPACE::ControlChange, (uint8_t)i, 100, MidiDestAll};
+			break;
+
+			case 1:
+			action->type = ActionEventOutput;
+			action->event.outputMessage.target = OutputBypassRelay;
+			action->event.outputMessage.value = OutputToggle;
+			break;
+
+			case 2:
+			action->type = ActionEventExp;
+			action->event.expMessage.value = 128;
+			break;
+
+			case 3:
+			action->type = ActionEventLed;
+			action->event.ledMessage.index = i % NUM_LEDS;
+			action->event.ledMessage.colour = 0x102030;
+			break;
+		}
+	}
+}
+
+static void storePreset(uint8_t index, Preset* p)
+{
+	actionPool_StorePreset(index, p);
+	presetBank_Invalidate(index);
+	if(index == globalConfig.currentPreset)
+	{
+		readCurrentPreset();
+	}
+}
+
+static std::string capturePresetPacket(uint8_t index)
+{
+	uint8_t current = globalConfig.currentPreset;
+	globalConfig.currentPreset = index;
+	readCurrentPreset();
+	serialCapture.clear();
+	captureSerial = true;
+	sendPresetPacket(index);
+	captureSerial = false;
+	globalConfig.currentPreset = current;
+	readCurrentPreset();
+	return serialCapture;
+}
+
+// Calibrates the iteration count to the minimum sample time, then reports the median of the samples
+template<typename F> static void runBenchmark(const std::string& name, uint64_t bytesPerOp, F fn)
+{
+	typedef std::chrono::steady_clock Clock;
+	uint64_t iterations = 1;
+	while(true)
+	{
+		Clock::time_point start = Clock::now();
+		for(uint64_t i=0; i<iterations; i++)
+		{
+			fn();
+		}
+		uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+		if(elapsed >= BENCH_MIN_SAMPLE_NS)
+		{
+			break;
+		}
+		iterations *= 2;
+	}
+
+	std::vector<double> samples;
+	for(uint8_t s=0; s<BENCH_SAMPLES; s++)
+	{
+		Clock::time_point start = Clock::now();
+		for(uint64_t i=0; i<iterations; i++)
+		{
+			fn();
+		}
+		uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+		samples.push_back((double)elapsed / iterations);
+	}
+	std::sort(samples.begin(), samples.end());
+
+	BenchResult result;
+	result.name = name;
+	result.iterations = iterations * BENCH_SAMPLES;
+	result.nsPerOp = samples[BENCH_SAMPLES / 2];
+	result.nsPerOpMin = samples[0];
+	result.bytesPerOp = bytesPerOp;
+	results.push_back(result);
+	fprintf(stderr, "%-40s %12.1f ns/op\n", name.c_str(), result.nsPerOp);
+}
+
+static void printResult(BenchResult* result)
+{
+	fprintf(output, "{\"benchmark\":\"%s\",\"iterations\":%llu,\"nsPerOp\":%.1f,\"nsPerOpMin\":%.1f,\"opsPerSec\":%.1f,\"bytesPerOp\":%llu",
+			result->name.c_str(), (unsigned long long)result->iterations, result->nsPerOp, result->nsPerOpMin,
+			1e9 / result->nsPerOp, (unsigned long long)result->bytesPerOp);
+	if(result->bytesPerOp)
+	{
+		fprintf(output, ",\"mbPerSec\":%.3f", (result->bytesPerOp * 1e3) / result->nsPerOp);
+	}
+	fprintf(output, "}\n");
+}
@@ -0,0 +1,29 @@
+#ifndef HOST_ADAFRUIT_NEOPIXEL_H_
+#define HOST_ADAFRUIT_NEOPIXEL_H_
+
+#include "Arduino.h"
+
+#define NEO_GRB		0x52
+#define NEO_KHZ800	0x0000
+#define HOST_MAX_PIXELS	64
+
+// show() reports the whole frame as a HostEventLeds
+class Adafruit_NeoPixel
+{
+public:
+	Adafruit_NeoPixel(uint16_t n, int16_t pin, uint16_t type);
+	void begin() {}
+	void clear();
+	void show();
+	void setPixelColor(uint16_t n, uint32_t colour);
+	uint32_t getPixelColor(uint16_t n) const;
+	uint16_t numPixels() const { return count; }
+	bool canShow() { return true; }
+	static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+private:
+	uint16_t count;
+	uint32_t pixels[HOST_MAX_PIXELS];
+};
+
+#endif /* HOST_ADAFRUIT_NEOPIXEL_H_ */
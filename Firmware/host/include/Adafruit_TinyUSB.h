@@ -0,0 +1,28 @@
+#ifndef HOST_ADAFRUIT_TINYUSB_H_
+#define HOST_ADAFRUIT_TINYUSB_H_
+
+#include "Arduino.h"
+
+// Incoming bytes are injected with host_UsbMidiInput(), event packets are reported as HostEventUsbMidi
+class Adafruit_USBD_MIDI : public HostStream
+{
+public:
+	Adafruit_USBD_MIDI(uint8_t cables = 1) : HostStream(HostEventUsbMidi) { (void)cables; }
+	void setCables(uint8_t cables) { (void)cables; }
+	bool setCableName(uint8_t cable, const char* name) { (void)cable; (void)name; return true; }
+	bool begin() { return true; }
+	bool writePacket(const uint8_t packet[4]);
+};
+
+class Adafruit_USBD_Device
+{
+public:
+	void setManufacturerDescriptor(const char* s) { (void)s; }
+	void setProductDescriptor(const char* s) { (void)s; }
+	bool mounted();
+};
+
+extern Adafruit_USBD_Device TinyUSBDevice;
+#define USBDevice TinyUSBDevice
+
+#endif /* HOST_ADAFRUIT_TINYUSB_H_ */
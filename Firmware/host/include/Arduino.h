@@ -0,0 +1,131 @@
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+// Minimal arduino-pico API surface used by the firmware, implemented in host/src/hal.cpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "host.h"
+
+typedef uint8_t byte;
+typedef unsigned int uint;
+
+#define LOW				0
+#define HIGH			1
+#define INPUT			0
+#define OUTPUT			1
+#define INPUT_PULLUP	2
+#define CHANGE			3
+#define FALLING		4
+#define RISING			5
+
+#define F(string)		(string)
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES	8
+#define NUM_HOST_PINS	30
+
+//------------------ GPIO -------------------//
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(int interrupt, void (*isr)(), int mode);
+void gpio_put(uint pin, bool value);
+bool gpio_get(uint pin);
+
+//------------------ Time -------------------//
+uint32_t millis();
+uint32_t micros();
+uint32_t time_us_32();
+uint64_t time_us_64();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+//------------------ System ------------------//
+void noInterrupts();
+void interrupts();
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+void tight_loop_contents();
+void __wfe();
+void __wfi();
+void __sev();
+void __dmb();
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delayMs);
+void pico_get_unique_board_id_string(char* str, uint len);
+
+// Only one core runs on the host
+class RP2040
+{
+public:
+	void idleOtherCore() {}
+	void resumeOtherCore() {}
+};
+extern RP2040 rp2040;
+
+//------------------ Serial ------------------//
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t* buffer, size_t size);
+	virtual int availableForWrite() { return 0; }
+	virtual void flush() {}
+	size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+	size_t print(const char* str) { return write(str); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(int value) { return printFormat("%d", value); }
+	size_t print(unsigned int value) { return printFormat("%u", value); }
+	size_t print(long value) { return printFormat("%ld", value); }
+	size_t print(unsigned long value) { return printFormat("%lu", value); }
+	size_t print(double value, int digits = 2) { return printFormat("%.*f", digits, value); }
+	size_t println() { return write("\r\n"); }
+	template<typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+	size_t printf(const char* format, ...);
+
+private:
+	size_t printFormat(const char* format, ...);
+};
+
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+};
+
+// Byte stream fed by the host and drained by the firmware
+class HostStream : public Stream
+{
+public:
+	HostStream(HostEventType outputEvent);
+	using Print::write;
+	void begin(unsigned long baud) { (void)baud; }
+	void end() {}
+	operator bool() { return true; }
+	int available() override;
+	int read() override;
+	int peek() override;
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+	int availableForWrite() override { return 256; }
+	void inject(const uint8_t* data, size_t len);
+
+private:
+	HostEventType outputEvent;
+	uint8_t rxBuffer[8192];
+	size_t rxHead;
+	size_t rxCount;
+};
+
+typedef HostStream HardwareSerial;
+typedef HostStream SerialUSB;
+typedef HostStream SerialUART;
+extern HostStream Serial;
+extern HostStream Serial1;
+
+#endif /* HOST_ARDUINO_H_ */
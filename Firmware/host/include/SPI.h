@@ -0,0 +1,28 @@
+#ifndef HOST_SPI_H_
+#define HOST_SPI_H_
+
+#include "Arduino.h"
+
+#define MSBFIRST	1
+#define SPI_MODE0	0
+
+class SPISettings
+{
+public:
+	SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) { (void)clock; (void)bitOrder; (void)dataMode; }
+};
+
+// Every transfer is reported as a HostEventSpi
+class HardwareSPI
+{
+public:
+	void begin() {}
+	void beginTransaction(SPISettings settings) { (void)settings; }
+	void endTransaction() {}
+	uint8_t transfer(uint8_t data);
+	uint16_t transfer16(uint16_t data);
+};
+
+extern HardwareSPI SPI;
+
+#endif /* HOST_SPI_H_ */
@@ -0,0 +1,46 @@
+#ifndef HOST_BUTTONS_H_
+#define HOST_BUTTONS_H_
+
+#include "Arduino.h"
+
+// Stand-in for the buttons library. Edges injected with host_SetPin() reach the
+// firmware ISR, which dispatches straight to the handler without debouncing
+typedef enum
+{
+	ButtonNoEvent = 0,
+	ButtonPress,
+	ButtonRelease,
+	ButtonHold
+} ButtonState;
+
+typedef enum
+{
+	Momentary,
+	Latching
+} ButtonMode;
+
+typedef enum
+{
+	ActiveLow,
+	ActiveHigh
+} ButtonLogicMode;
+
+typedef enum
+{
+	ButtonEmulateNone,
+	ButtonEmulatePress,
+	ButtonEmulateRelease
+} ButtonEmulate;
+
+typedef struct
+{
+	ButtonMode mode;
+	ButtonLogicMode logicMode;
+	void (*handler)(ButtonState state);
+	uint8_t pin;
+} Button;
+
+void buttons_Init(Button* button);
+void buttons_ExtiGpioCallback(Button* button, ButtonEmulate emulate);
+
+#endif /* HOST_BUTTONS_H_ */
@@ -0,0 +1,29 @@
+#ifndef HOST_HARDWARE_ADC_H_
+#define HOST_HARDWARE_ADC_H_
+
+#include "Arduino.h"
+
+#define DREQ_ADC	36
+
+typedef struct
+{
+	volatile uint32_t cs;
+	volatile uint32_t result;
+	volatile uint32_t fcs;
+	volatile uint32_t fifo;
+	volatile uint32_t div;
+} adc_hw_t;
+
+extern adc_hw_t* adc_hw;
+
+// The host ADC has no converter, the DMA sample ring stays at zero
+void adc_init();
+void adc_gpio_init(uint gpio);
+void adc_select_input(uint input);
+void adc_set_round_robin(uint mask);
+void adc_fifo_setup(bool enable, bool dreq, uint16_t threshold, bool errorInFifo, bool byteShift);
+void adc_fifo_drain();
+void adc_run(bool run);
+void adc_set_clkdiv(float clkdiv);
+
+#endif /* HOST_HARDWARE_ADC_H_ */
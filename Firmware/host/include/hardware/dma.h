@@ -0,0 +1,47 @@
+#ifndef HOST_HARDWARE_DMA_H_
+#define HOST_HARDWARE_DMA_H_
+
+#include "Arduino.h"
+
+#define HOST_DMA_CHANNELS	12
+
+enum dma_channel_transfer_size
+{
+	DMA_SIZE_8 = 0,
+	DMA_SIZE_16 = 1,
+	DMA_SIZE_32 = 2
+};
+
+typedef struct
+{
+	uint32_t ctrl;
+} dma_channel_config;
+
+typedef struct
+{
+	volatile uint32_t read_addr;
+	volatile uint32_t write_addr;
+	volatile uint32_t transfer_count;
+	volatile uint32_t ctrl_trig;
+} dma_channel_hw_t;
+
+// Only transfers into a UART data register are simulated. They complete after the
+// wire time set by host_SetUartBaud(), all other channels are accepted and ignored
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config* c, bool increment);
+void channel_config_set_write_increment(dma_channel_config* c, bool increment);
+void channel_config_set_dreq(dma_channel_config* c, uint dreq);
+void channel_config_set_ring(dma_channel_config* c, bool write, uint sizeBits);
+void channel_config_set_chain_to(dma_channel_config* c, uint channel);
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* writeAddr,
+									const volatile void* readAddr, uint transferCount, bool trigger);
+void dma_channel_start(uint channel);
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* readAddr, uint32_t transferCount);
+dma_channel_hw_t* dma_channel_hw_addr(uint channel);
+
+#endif /* HOST_HARDWARE_DMA_H_ */
@@ -0,0 +1,22 @@
+#ifndef HOST_HARDWARE_FLASH_H_
+#define HOST_HARDWARE_FLASH_H_
+
+#include "Arduino.h"
+
+// Flash is a RAM array that starts erased. XIP reads are plain reads of the array,
+// erases and programs are reported as HostEventFlash and enforce the NOR rules.
+// They take the typical time of the Pico's W25Q16JV on the host clock, as the core
+// is stalled for it. Storage also reports its stalls at the part's maximum times,
+// STORAGE_ERASE_WORST_US and STORAGE_PROGRAM_WORST_US
+#define FLASH_PAGE_SIZE			256
+#define FLASH_SECTOR_SIZE			4096
+#define HOST_FLASH_SIZE			(64 * 1024)
+#define XIP_BASE					host_FlashBase()
+#define HOST_FLASH_ERASE_US		45000		// Per sector
+#define HOST_FLASH_PROGRAM_US		400		// Per page
+
+uintptr_t host_FlashBase();
+void flash_range_erase(uint32_t flashOffs, size_t count);
+void flash_range_program(uint32_t flashOffs, const uint8_t* data, size_t count);
+
+#endif /* HOST_HARDWARE_FLASH_H_ */
@@ -0,0 +1,2 @@
+// save_and_disable_interrupts() and restore_interrupts() are declared in Arduino.h
+#include "Arduino.h"
@@ -0,0 +1,21 @@
+#ifndef HOST_HARDWARE_UART_H_
+#define HOST_HARDWARE_UART_H_
+
+#include "Arduino.h"
+
+#define UART_UARTDMACR_TXDMAE_BITS	0x00000002
+
+typedef struct
+{
+	volatile uint32_t dr;
+	volatile uint32_t dmacr;
+} uart_hw_t;
+
+typedef struct uart_inst uart_inst_t;
+extern uart_inst_t* uart0;
+extern uart_inst_t* uart1;
+
+uart_hw_t* uart_get_hw(uart_inst_t* uart);
+uint uart_get_dreq(uart_inst_t* uart, bool tx);
+
+#endif /* HOST_HARDWARE_UART_H_ */
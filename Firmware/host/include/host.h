@@ -0,0 +1,58 @@
+#ifndef HOST_H_
+#define HOST_H_
+
+// Host (Linux) implementation of the hardware the firmware talks to.
+// Only used by the native PlatformIO environments, never by the device build.
+
+#include <stdint.h>
+#include <stddef.h>
+
+//------------------ Types -----------------//
+typedef enum
+{
+	HostEventGpio = 0,		// arg = pin, data[0] = level
+	HostEventSpi,				// data = bytes clocked out
+	HostEventUart,				// data = bytes leaving the TRS MIDI UART
+	HostEventUsbMidi,			// data = 4 byte USB MIDI event packet
+	HostEventLeds,				// data = 32-bit colours, arg = pixel count
+	HostEventSerial,			// data = bytes written to the USB CDC serial
+	HostEventFlash,			// data = bytes programmed or NULL for an erase, arg = flash offset
+	NUM_HOST_EVENTS
+} HostEventType;
+
+typedef void (*HostEventHandler)(HostEventType type, const uint8_t* data, uint32_t len, uint32_t arg);
+
+
+//------------------ Clock -----------------//
+// By default the clock follows real time. A simulated clock only moves when told to
+void host_UseSimulatedClock(bool simulated);
+uint64_t host_Now();
+void host_Advance(uint64_t us);
+// Time of the next input the driver will deliver, which wakes a simulated wait
+// (best_effort_wfe_or_timeout) early. UINT64_MAX when there is none
+void host_SetNextEvent(uint64_t us);
+
+//------------------ Outputs -----------------//
+void host_SetEventHandler(HostEventHandler handler);
+void host_Emit(HostEventType type, const uint8_t* data, uint32_t len, uint32_t arg);
+// TRS UART wire speed. 0 makes DMA transfers complete instantly
+void host_SetUartBaud(uint32_t baud);
+uint32_t host_EventCount(HostEventType type);
+
+//------------------ Inputs -----------------//
+void host_SetPin(uint8_t pin, bool level);
+bool host_GetPin(uint8_t pin);
+void host_SerialInput(const uint8_t* data, size_t len);
+void host_UartInput(const uint8_t* data, size_t len);
+void host_UsbMidiInput(const uint8_t* data, size_t len);
+void host_SetUsbMounted(bool mounted);
+bool host_ResetRequested();
+void host_ClearResetRequest();
+
+//------------------ Memory -----------------//
+// Address of an RP2040 linker symbol in the host's stand-in memory map.
+// The stacks are real (painted but never used), _FS_start/_FS_end cover the host flash
+// array (hardware/flash.h), static and heap regions report as empty
+uintptr_t host_MemorySymbol(const char* name);
+
+#endif /* HOST_H_ */
@@ -0,0 +1,14 @@
+#ifndef HOST_PICO_TIME_H_
+#define HOST_PICO_TIME_H_
+
+#include "Arduino.h"
+
+// On the real time clock waits return at once and the caller's loop decides how
+// time moves. On the simulated clock a wait moves the clock to its timeout, or to
+// the next input the driver announced with host_SetNextEvent() if that is sooner
+typedef uint64_t absolute_time_t;
+
+absolute_time_t from_us_since_boot(uint64_t us);
+bool best_effort_wfe_or_timeout(absolute_time_t timeout);
+
+#endif /* HOST_PICO_TIME_H_ */
@@ -0,0 +1,2 @@
+// picomod.h includes "spi.h", the device toolchain resolves it case insensitively
+#include "SPI.h"
@@ -0,0 +1,651 @@
+#include <chrono>
+#include <stdarg.h>
+#include "Arduino.h"
+#include "SPI.h"
+#include "Adafruit_TinyUSB.h"
+#include "Adafruit_NeoPixel.h"
+#include "buttons.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/uart.h"
+#include "pico/time.h"
+
+typedef struct
+{
+	bool claimed;
+	volatile void* writeAddr;
+	uint64_t busyUntil;
+	dma_channel_hw_t hw;
+} HostDmaChannel;
+
+// Clock
+static bool simulatedClock = false;
+static uint64_t simulatedNow = 0;
+static uint64_t clockOffset = 0;
+static uint64_t nextEvent = UINT64_MAX;
+static std::chrono::steady_clock::time_point clockStart = std::chrono::steady_clock::now();
+
+// Outputs
+static HostEventHandler eventHandler = NULL;
+static uint32_t eventCounts[NUM_HOST_EVENTS];
+static uint32_t uartBaud = 31250;
+
+// Inputs
+static bool pinLevels[NUM_HOST_PINS];
+static void (*pinIsrs[NUM_HOST_PINS])();
+static bool usbMounted = true;
+static bool resetRequested = false;
+
+// Memory
+#define HOST_STACK_SIZE	4096
+static uint32_t hostStacks[2][HOST_STACK_SIZE / sizeof(uint32_t)];
+static uint8_t hostFlash[HOST_FLASH_SIZE];
+static bool hostFlashErased = false;
+
+// Peripherals
+static HostDmaChannel dmaChannels[HOST_DMA_CHANNELS];
+static adc_hw_t adcRegisters;
+static uart_hw_t uartRegisters[2];
+static uart_inst_t* uartInstances[2] = {(uart_inst_t*)&uartRegisters[0], (uart_inst_t*)&uartRegisters[1]};
+
+adc_hw_t* adc_hw = &adcRegisters;
+uart_inst_t* uart0 = uartInstances[0];
+uart_inst_t* uart1 = uartInstances[1];
+
+HostStream Serial(HostEventSerial);
+HostStream Serial1(HostEventUart);
+HardwareSPI SPI;
+RP2040 rp2040;
+Adafruit_USBD_Device TinyUSBDevice;
+
+
+//------------------ Clock -----------------//
+void host_UseSimulatedClock(bool simulated)
+{
+	simulatedClock = simulated;
+	simulatedNow = 0;
+	clockOffset = 0;
+	nextEvent = UINT64_MAX;
+	clockStart = std::chrono::steady_clock::now();
+}
+
+uint64_t host_Now()
+{
+	if(simulatedClock)
+	{
+		return simulatedNow;
+	}
+	auto elapsed = std::chrono::steady_clock::now() - clockStart;
+	return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() + clockOffset;
+}
+
+// In real time mode the advance is added as an offset, the host never sleeps
+void host_Advance(uint64_t us)
+{
+	if(simulatedClock)
+	{
+		simulatedNow += us;
+	}
+	else
+	{
+		clockOffset += us;
+	}
+}
+
+void host_SetNextEvent(uint64_t us)
+{
+	nextEvent = us;
+}
+
+
+//------------------ Outputs -----------------//
+void host_SetEventHandler(HostEventHandler handler)
+{
+	eventHandler = handler;
+}
+
+void host_Emit(HostEventType type, const uint8_t* data, uint32_t len, uint32_t arg)
+{
+	eventCounts[type]++;
+	if(eventHandler)
+	{
+		eventHandler(type, data, len, arg);
+	}
+}
+
+void host_SetUartBaud(uint32_t baud)
+{
+	uartBaud = baud;
+}
+
+uint32_t host_EventCount(HostEventType type)
+{
+	return eventCounts[type];
+}
+
+
+//------------------ Inputs -----------------//
+// Changing an input pin fires the interrupt attached to it, like a CHANGE interrupt would
+void host_SetPin(uint8_t pin, bool level)
+{
+	if(pin >= NUM_HOST_PINS)
+	{
+		return;
+	}
+	bool changed = pinLevels[pin] != level;
+	pinLevels[pin] = level;
+	if(changed && pinIsrs[pin])
+	{
+		pinIsrs[pin]();
+	}
+}
+
+bool host_GetPin(uint8_t pin)
+{
+	return pin < NUM_HOST_PINS ? pinLevels[pin] : false;
+}
+
+void host_SerialInput(const uint8_t* data, size_t len)
+{
+	Serial.inject(data, len);
+}
+
+void host_UartInput(const uint8_t* data, size_t len)
+{
+	Serial1.inject(data, len);
+}
+
+void host_SetUsbMounted(bool mounted)
+{
+	usbMounted = mounted;
+}
+
+bool host_ResetRequested()
+{
+	return resetRequested;
+}
+
+void host_ClearResetRequest()
+{
+	resetRequested = false;
+}
+
+
+//------------------ GPIO -------------------//
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	// Pull ups idle high, which is the released state of the footswitches
+	if(pin < NUM_HOST_PINS && mode == INPUT_PULLUP)
+	{
+		pinLevels[pin] = HIGH;
+	}
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+	gpio_put(pin, value);
+}
+
+int digitalRead(uint8_t pin)
+{
+	return gpio_get(pin);
+}
+
+int digitalPinToInterrupt(uint8_t pin)
+{
+	return pin;
+}
+
+void attachInterrupt(int interrupt, void (*isr)(), int mode)
+{
+	(void)mode;
+	if(interrupt >= 0 && interrupt < NUM_HOST_PINS)
+	{
+		pinIsrs[interrupt] = isr;
+	}
+}
+
+void gpio_put(uint pin, bool value)
+{
+	if(pin >= NUM_HOST_PINS)
+	{
+		return;
+	}
+	pinLevels[pin] = value;
+	uint8_t level = value;
+	host_Emit(HostEventGpio, &level, 1, pin);
+}
+
+bool gpio_get(uint pin)
+{
+	return host_GetPin(pin);
+}
+
+
+//------------------ Time -------------------//
+uint32_t millis()
+{
+	return host_Now() / 1000;
+}
+
+uint32_t micros()
+{
+	return host_Now();
+}
+
+uint32_t time_us_32()
+{
+	return host_Now();
+}
+
+uint64_t time_us_64()
+{
+	return host_Now();
+}
+
+void delay(uint32_t ms)
+{
+	host_Advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	host_Advance(us);
+}
+
+absolute_time_t from_us_since_boot(uint64_t us)
+{
+	return us;
+}
+
+// Returns true when the timeout was reached rather than woken by an event
+bool best_effort_wfe_or_timeout(absolute_time_t timeout)
+{
+	if(!simulatedClock)
+	{
+		return false;
+	}
+	uint64_t wake = nextEvent < timeout ? nextEvent : timeout;
+	if(wake > simulatedNow)
+	{
+		simulatedNow = wake;
+	}
+	return wake == timeout;
+}
+
+
+//------------------ System ------------------//
+void noInterrupts() {}
+void interrupts() {}
+uint32_t save_and_disable_interrupts() { return 0; }
+void restore_interrupts(uint32_t status) { (void)status; }
+void tight_loop_contents() {}
+void __wfe() {}
+void __wfi() {}
+void __sev() {}
+void __dmb() {}
+
+// The device would never return from here. The host records the request and carries on
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delayMs)
+{
+	(void)pc;
+	(void)sp;
+	(void)delayMs;
+	resetRequested = true;
+}
+
+void pico_get_unique_board_id_string(char* str, uint len)
+{
+	snprintf(str, len, "%s", "E660000000000000");
+}
+
+uintptr_t host_MemorySymbol(const char* name)
+{
+	static const struct
+	{
+		const char* name;
+		uintptr_t address;
+	} symbols[] =
+	{
+		{"__StackBottom", (uintptr_t)hostStacks[0]},
+		{"__StackTop", (uintptr_t)hostStacks[0] + HOST_STACK_SIZE},
+		{"__StackOneBottom", (uintptr_t)hostStacks[1]},
+		{"__StackOneTop", (uintptr_t)hostStacks[1] + HOST_STACK_SIZE},
+		{"_FS_start", host_FlashBase()},
+		{"_FS_end", host_FlashBase() + HOST_FLASH_SIZE}
+	};
+	for(size_t i=0; i<sizeof(symbols)/sizeof(symbols[0]); i++)
+	{
+		if(strcmp(symbols[i].name, name) == 0)
+		{
+			return symbols[i].address;
+		}
+	}
+	return 0;
+}
+
+
+//------------------ Serial ------------------//
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+	size_t n = 0;
+	while(size--)
+	{
+		n += write(*buffer++);
+	}
+	return n;
+}
+
+size_t Print::printf(const char* format, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	return write((const uint8_t*)buffer, len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1);
+}
+
+size_t Print::printFormat(const char* format, ...)
+{
+	char buffer[64];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	return write((const uint8_t*)buffer, len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1);
+}
+
+HostStream::HostStream(HostEventType outputEvent) : outputEvent(outputEvent), rxHead(0), rxCount(0)
+{
+}
+
+int HostStream::available()
+{
+	return rxCount;
+}
+
+int HostStream::read()
+{
+	if(rxCount == 0)
+	{
+		return -1;
+	}
+	uint8_t c = rxBuffer[rxHead];
+	rxHead = (rxHead + 1) % sizeof(rxBuffer);
+	rxCount--;
+	return c;
+}
+
+int HostStream::peek()
+{
+	return rxCount ? rxBuffer[rxHead] : -1;
+}
+
+size_t HostStream::write(uint8_t c)
+{
+	host_Emit(outputEvent, &c, 1, 0);
+	return 1;
+}
+
+size_t HostStream::write(const uint8_t* buffer, size_t size)
+{
+	host_Emit(outputEvent, buffer, size, 0);
+	return size;
+}
+
+// Bytes that do not fit are dropped, as a full device FIFO would
+void HostStream::inject(const uint8_t* data, size_t len)
+{
+	for(size_t i=0; i<len && rxCount<sizeof(rxBuffer); i++)
+	{
+		rxBuffer[(rxHead + rxCount) % sizeof(rxBuffer)] = data[i];
+		rxCount++;
+	}
+}
+
+
+//------------------ SPI -------------------//
+uint8_t HardwareSPI::transfer(uint8_t data)
+{
+	host_Emit(HostEventSpi, &data, 1, 0);
+	return 0;
+}
+
+uint16_t HardwareSPI::transfer16(uint16_t data)
+{
+	uint8_t bytes[2] = {(uint8_t)(data >> 8), (uint8_t)data};
+	host_Emit(HostEventSpi, bytes, 2, 0);
+	return 0;
+}
+
+
+//------------------ Flash -------------------//
+uintptr_t host_FlashBase()
+{
+	if(!hostFlashErased)
+	{
+		memset(hostFlash, 0xFF, sizeof(hostFlash));
+		hostFlashErased = true;
+	}
+	return (uintptr_t)hostFlash;
+}
+
+void flash_range_erase(uint32_t flashOffs, size_t count)
+{
+	host_FlashBase();
+	if(flashOffs % FLASH_SECTOR_SIZE || count % FLASH_SECTOR_SIZE || flashOffs + count > HOST_FLASH_SIZE)
+	{
+		fprintf(stderr, "flash_range_erase: bad range %u + %zu\n", flashOffs, count);
+		abort();
+	}
+	memset(&hostFlash[flashOffs], 0xFF, count);
+	host_Advance((count / FLASH_SECTOR_SIZE) * HOST_FLASH_ERASE_US);
+	host_Emit(HostEventFlash, NULL, count, flashOffs);
+}
+
+// Programming can only clear bits, as on the real part
+void flash_range_program(uint32_t flashOffs, const uint8_t* data, size_t count)
+{
+	host_FlashBase();
+	if(flashOffs % FLASH_PAGE_SIZE || count % FLASH_PAGE_SIZE || flashOffs + count > HOST_FLASH_SIZE)
+	{
+		fprintf(stderr, "flash_range_program: bad range %u + %zu\n", flashOffs, count);
+		abort();
+	}
+	for(size_t i=0; i<count; i++)
+	{
+		hostFlash[flashOffs + i] &= data[i];
+	}
+	host_Advance((count / FLASH_PAGE_SIZE) * HOST_FLASH_PROGRAM_US);
+	host_Emit(HostEventFlash, data, count, flashOffs);
+}
+
+
+//------------------ TinyUSB -------------------//
+// The firmware owns the USB MIDI interface object
+extern Adafruit_USBD_MIDI usb_midi;
+
+void host_UsbMidiInput(const uint8_t* data, size_t len)
+{
+	usb_midi.inject(data, len);
+}
+
+bool Adafruit_USBD_MIDI::writePacket(const uint8_t packet[4])
+{
+	host_Emit(HostEventUsbMidi, packet, 4, 0);
+	return true;
+}
+
+bool Adafruit_USBD_Device::mounted()
+{
+	return usbMounted;
+}
+
+
+//------------------ NeoPixel -------------------//
+Adafruit_NeoPixel::Adafruit_NeoPixel(uint16_t n, int16_t pin, uint16_t type)
+{
+	(void)pin;
+	(void)type;
+	count = n < HOST_MAX_PIXELS ? n : HOST_MAX_PIXELS;
+	clear();
+}
+
+void Adafruit_NeoPixel::clear()
+{
+	memset(pixels, 0, sizeof(pixels));
+}
+
+void Adafruit_NeoPixel::show()
+{
+	host_Emit(HostEventLeds, (const uint8_t*)pixels, count * sizeof(uint32_t), count);
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint32_t colour)
+{
+	if(n < count)
+	{
+		pixels[n] = colour;
+	}
+}
+
+uint32_t Adafruit_NeoPixel::getPixelColor(uint16_t n) const
+{
+	return n < count ? pixels[n] : 0;
+}
+
+
+//------------------ Buttons -------------------//
+void buttons_Init(Button* button)
+{
+	(void)button;
+}
+
+void buttons_ExtiGpioCallback(Button* button, ButtonEmulate emulate)
+{
+	(void)emulate;
+	bool level = host_GetPin(button->pin);
+	bool pressed = button->logicMode == ActiveLow ? !level : level;
+	if(button->handler)
+	{
+		button->handler(pressed ? ButtonPress : ButtonRelease);
+	}
+}
+
+
+//------------------ ADC -------------------//
+void adc_init() {}
+void adc_gpio_init(uint gpio) { (void)gpio; }
+void adc_select_input(uint input) { (void)input; }
+void adc_set_round_robin(uint mask) { (void)mask; }
+void adc_fifo_setup(bool enable, bool dreq, uint16_t threshold, bool errorInFifo, bool byteShift)
+{
+	(void)enable; (void)dreq; (void)threshold; (void)errorInFifo; (void)byteShift;
+}
+void adc_fifo_drain() {}
+void adc_run(bool run) { (void)run; }
+void adc_set_clkdiv(float clkdiv) { (void)clkdiv; }
+
+
+//------------------ UART -------------------//
+uart_hw_t* uart_get_hw(uart_inst_t* uart)
+{
+	return (uart_hw_t*)uart;
+}
+
+uint uart_get_dreq(uart_inst_t* uart, bool tx)
+{
+	return (uart == uart0 ? 20 : 22) + (tx ? 0 : 1);
+}
+
+
+//------------------ DMA -------------------//
+int dma_claim_unused_channel(bool required)
+{
+	for(uint8_t i=0; i<HOST_DMA_CHANNELS; i++)
+	{
+		if(!dmaChannels[i].claimed)
+		{
+			memset(&dmaChannels[i], 0, sizeof(HostDmaChannel));
+			dmaChannels[i].claimed = true;
+			return i;
+		}
+	}
+	if(required)
+	{
+		abort();
+	}
+	return -1;
+}
+
+void dma_channel_unclaim(uint channel)
+{
+	dmaChannels[channel].claimed = false;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+	(void)channel;
+	dma_channel_config config = {0};
+	return config;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) { (void)c; (void)size; }
+void channel_config_set_read_increment(dma_channel_config* c, bool increment) { (void)c; (void)increment; }
+void channel_config_set_write_increment(dma_channel_config* c, bool increment) { (void)c; (void)increment; }
+void channel_config_set_dreq(dma_channel_config* c, uint dreq) { (void)c; (void)dreq; }
+void channel_config_set_ring(dma_channel_config* c, bool write, uint sizeBits) { (void)c; (void)write; (void)sizeBits; }
+void channel_config_set_chain_to(dma_channel_config* c, uint channel) { (void)c; (void)channel; }
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* writeAddr,
+									const volatile void* readAddr, uint transferCount, bool trigger)
+{
+	(void)config;
+	dmaChannels[channel].writeAddr = writeAddr;
+	dmaChannels[channel].hw.write_addr = (uint32_t)(uintptr_t)writeAddr;
+	if(trigger)
+	{
+		dma_channel_transfer_from_buffer_now(channel, readAddr, transferCount);
+	}
+}
+
+void dma_channel_start(uint channel)
+{
+	(void)channel;
+}
+
+void dma_channel_abort(uint channel)
+{
+	dmaChannels[channel].busyUntil = 0;
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+	return host_Now() < dmaChannels[channel].busyUntil;
+}
+
+// Transfers into a UART are emitted as wire bytes, busy for the time they take at the set baud rate
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* readAddr, uint32_t transferCount)
+{
+	HostDmaChannel* dma = &dmaChannels[channel];
+	if(transferCount == 0)
+	{
+		return;
+	}
+	if(dma->writeAddr == &uartRegisters[0].dr || dma->writeAddr == &uartRegisters[1].dr)
+	{
+		host_Emit(HostEventUart, (const uint8_t*)readAddr, transferCount, 0);
+		if(uartBaud)
+		{
+			// 10 bits per byte on the wire
+			dma->busyUntil = host_Now() + ((uint64_t)transferCount * 10 * 1000000) / uartBaud;
+		}
+	}
+}
+
+dma_channel_hw_t* dma_channel_hw_addr(uint channel)
+{
+	return &dmaChannels[channel].hw;
+}
@@ -0,0 +1,55 @@
+#ifndef ACTIONCODE_H_
+#define ACTIONCODE_H_
+
+#include "picomod.h"
+
+// Preset actions compiled into a linear bytecode program, one entry point per trigger.
+// Everything that can be decided when the preset loads is: the trigger event and
+// controller matching, MIDI destinations, output targets, LED colours. The interpreter
+// only checks conditions, derives values and drives the outputs.
+// Each instruction is an opcode followed by its operand bytes.
+
+//------------ Program Configuration ------------//
+#define ACTION_CODE_MAX_PER_ACTION	16		// Match + condition + value + the longest event
+#define ACTION_CODE_SIZE				(NUM_SWITCH_ACTIONS * ACTION_CODE_MAX_PER_ACTION + NUM_TRIGGER_TYPES)
+
+
+//------------------ Types -----------------//
+typedef enum
+{
+	OpEnd = 0,
+	OpMatch,				// number, skip. Skips the action unless the trigger number matches
+	OpIf,					// condition, operand, skip. Skips the action unless the condition holds
+	OpValue,				// valueOp, operand. Derives the value from the triggering value
+	OpMidi,				// destination, type, channel, data1, data2
+	OpMidiValue1,		// destination, type, channel. data1 is the value
+	OpMidiValue2,		// destination, type, channel, data1. data2 is the value
+	OpExp,				// wiper low, wiper high
+	OpExpValue,			// The value scaled to the wiper range
+	OpBypassOn,
+	OpBypassOff,
+	OpBypassToggle,
+	OpAuxOn,
+	OpAuxOff,
+	OpAuxToggle,
+	OpAnalogSwitchOn,
+	OpAnalogSwitchOff,
+	OpAnalogSwitchToggle,
+	OpLed,				// index, red, green, blue
+	NUM_ACTION_OPS
+} ActionOp;
+
+typedef struct
+{
+	uint16_t entry[NUM_TRIGGER_TYPES];		// Offset of each trigger's code
+	uint16_t length;
+	uint8_t code[ACTION_CODE_SIZE];
+} ActionProgram;
+
+static_assert(ACTION_CODE_SIZE <= UINT16_MAX, "Entry offsets are 16 bit");
+
+
+void actionCode_Compile(const Preset* preset, ActionProgram* program);
+void actionCode_Run(const ActionProgram* program, TriggerType triggerType, uint8_t number, uint8_t value);
+
+#endif /* ACTIONCODE_H_ */
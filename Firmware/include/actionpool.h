@@ -0,0 +1,53 @@
+#ifndef ACTIONPOOL_H_
+#define ACTIONPOOL_H_
+
+#include "picomod.h"
+
+// Shared pool of action blocks. A stored preset holds the index of a block for each
+// of its actions instead of a copy, and identical actions in any number of presets
+// share one block. Saving a preset interns its actions: an action already in the pool
+// takes another reference to that block, anything new is written to a free block.
+// Blocks no longer referenced by any preset are reclaimed as the presets are saved.
+// Reference counts and block hashes live in RAM only, rebuilt from the stored
+// presets at boot. Rewriting a block changes that action in every preset using it.
+
+//------------ Pool Configuration ------------//
+// Half of every action slot in every preset, a save that needs more is refused
+#define ACTION_POOL_SIZE			(NUM_PRESETS * NUM_SWITCH_ACTIONS / 2)
+#define ACTION_BLOCK_NONE			0xFFFF		// Unused action slot
+
+
+//------------------ Types -----------------//
+// The stored form of a preset
+typedef struct
+{
+	uint32_t id;
+	uint8_t numActions;
+	uint16_t actions[NUM_SWITCH_ACTIONS];	// Block index per action
+	uint16_t expValue;
+	uint8_t switch1State;
+	uint8_t switch2State;
+	uint8_t analogSwitchState;
+	uint8_t bypassRelayState;
+	uint8_t auxRelayState;
+} PresetRecord;
+
+typedef struct
+{
+	uint16_t used;					// Blocks referenced by at least one preset
+	uint16_t shared;				// Blocks referenced by more than one preset slot
+	uint16_t references;			// Action slots pointing into the pool
+	uint32_t reclaimed;			// Blocks freed since boot
+	uint32_t poolFull;			// Saves refused for lack of free blocks
+} ActionPoolStats;
+
+
+void actionPool_Init();
+bool actionPool_ReadRecord(uint8_t index, PresetRecord* record);
+void actionPool_LoadPreset(uint8_t index, Preset* preset);
+bool actionPool_StorePreset(uint8_t index, const Preset* preset);
+bool actionPool_WriteBlock(uint16_t block, const Action* action);
+uint32_t actionPool_PresetHash(uint8_t index);
+const ActionPoolStats* actionPool_GetStats();
+
+#endif /* ACTIONPOOL_H_ */
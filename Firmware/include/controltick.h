@@ -0,0 +1,34 @@
+#ifndef CONTROLTICK_H_
+#define CONTROLTICK_H_
+
+#include "Arduino.h"
+
+// Fixed rate tick for the periodic control work, and the idle sleep of the main loop.
+// Tick deadlines are absolute, a late tick does not move the ones after it. Ticks that
+// are missed entirely are counted as overruns rather than run back to back.
+// Between passes with nothing left to do the core waits in WFE, woken by any interrupt
+// (USB, TRS UART, switches) or by the next tick deadline at the latest.
+
+//------------ Tick Configuration ------------//
+#define CONTROL_TICK_US				1000		// 1kHz
+
+
+//------------------ Types -----------------//
+typedef struct
+{
+	uint32_t ticks;				// Ticks run
+	uint32_t overruns;			// Ticks skipped because the loop was a whole period late
+	uint32_t maxLateUs;			// Worst start of a tick after its deadline
+	uint32_t maxTickUs;			// Longest tick
+	uint32_t sleeps;
+	uint64_t sleptUs;				// Time spent waiting for an event
+} ControlTickStats;
+
+
+void controlTick_Init();
+bool controlTick_Due();
+void controlTick_Done();
+void controlTick_Sleep();
+const ControlTickStats* controlTick_GetStats();
+
+#endif /* CONTROLTICK_H_ */
@@ -0,0 +1,30 @@
+#ifndef EXPINPUT_H_
+#define EXPINPUT_H_
+
+#include "Arduino.h"
+
+//----------- Sampling Configuration -----------//
+// All four ADC inputs are sampled round robin so the ring interleave stays aligned
+// to a power of two. Only inputs with an active mode have their pads switched to analog.
+#define EXP_ADC_CHANNELS			4
+#define EXP_RING_BITS				7		// 2^7 bytes = 64 x 16-bit samples
+#define EXP_RING_SAMPLES			((1 << EXP_RING_BITS) / sizeof(uint16_t))
+#define EXP_OVERSAMPLE				(EXP_RING_SAMPLES / EXP_ADC_CHANNELS)
+#define EXP_SAMPLE_RATE				8000	// Total conversions per second across all channels
+
+//------------ Processing Configuration ------------//
+#define EXP_FILTER_SHIFT			2		// One pole IIR, higher = smoother but slower
+#define EXP_HYSTERESIS				32		// In 14-bit position units (1/4 of a 7-bit step)
+#define EXP_MIN_SEND_INTERVAL_MS	10		// Per input output rate limit
+#define EXP_POSITION_MAX			16383
+#define EXP_ADC_MAX					4095
+
+
+void expInput_Init();
+void expInput_Process();
+void expInput_StartCalibration();
+void expInput_EndCalibration();
+bool expInput_IsCalibrating();
+uint16_t expInput_GetPosition(uint8_t index);
+
+#endif /* EXPINPUT_H_ */
@@ -0,0 +1,39 @@
+#ifndef MEMSTATS_H_
+#define MEMSTATS_H_
+
+#include "Arduino.h"
+
+//------------ Memory Stats Configuration ------------//
+#define MEM_STACK_PAINT			0xC5C5C5C5	// Pattern written over unused stack at boot
+#define MEM_STACK_PAINT_GUARD		64				// Bytes below the live stack pointer left unpainted
+#define MEM_NUM_CORES				2
+
+
+//------------------ Types -----------------//
+typedef struct
+{
+	uint32_t size;
+	uint32_t highWater;			// Deepest use seen since boot
+} MemStackStats;
+
+typedef struct
+{
+	uint32_t dataSize;			// Initialised statics copied to RAM
+	uint32_t bssSize;				// Zeroed statics
+	uint32_t heapSize;			// End of statics to the stack limit
+	uint32_t heapArena;			// Heap claimed from the system so far
+	uint32_t heapUsed;
+	uint32_t heapFree;			// Free blocks inside the claimed arena
+	MemStackStats stacks[MEM_NUM_CORES];
+	uint32_t jsonArenaSize;
+	uint32_t jsonArenaPeak;
+	uint32_t jsonArenaOverflows;
+} MemStats;
+
+
+void memStats_Init();
+uint32_t memStats_StackHighWater(uint8_t core);
+void memStats_RecordJsonArena(size_t capacity, size_t used, bool overflowed);
+void memStats_Get(MemStats* stats);
+
+#endif /* MEMSTATS_H_ */
@@ -0,0 +1,95 @@
+#ifndef MIDIOUT_H_
+#define MIDIOUT_H_
+
+#include "Arduino.h"
+#include "MIDI.h"
+#include "Adafruit_TinyUSB.h"
+#include "hardware/uart.h"
+
+//------------- Queue Configuration -------------//
+#define MIDI_OUT_QUEUE_SIZE				32
+#define MIDI_OUT_PRIORITY_QUEUE_SIZE	8
+// Running status is refreshed after this much idle time so late joining receivers resync
+#define MIDI_OUT_RUNNING_STATUS_MS		300
+// Bytes handed to the TRS DMA per transfer. Kept small (~5ms of wire time) so queued
+// values can still be coalesced, the UART FIFO covers the gap between transfers
+#define MIDI_OUT_DMA_BATCH				16
+#define MIDI_OUT_TRS_UART				uart0		// Serial1
+// USB event packets are held back and handed to TinyUSB together. They are released once
+// a 64 byte full speed transfer worth is waiting, when a priority message is waiting, at the
+// end of a trigger dispatch (midiOut_Flush) or at the latest this long after the oldest was queued
+#define MIDI_OUT_USB_FRAME_PACKETS		16
+#define MIDI_OUT_USB_FLUSH_US			1000
+// SysEx bytes waiting to be packed into USB event packets
+#define MIDI_OUT_SYSEX_BUFFER_SIZE		512
+
+
+//------------------ Types -----------------//
+typedef enum
+{
+	MidiPortTrs = 0,
+	MidiPortUsb,
+	NUM_MIDI_PORTS
+} MidiPort;
+
+// Virtual cables of the USB MIDI interface, each appears as its own port on the host
+typedef enum
+{
+	MidiCableLocal = 0,		// Preset actions
+	MidiCableTrsMirror,		// Everything received on the TRS input
+	MidiCableClock,			// Realtime messages sent by preset actions
+	NUM_MIDI_USB_CABLES
+} MidiUsbCable;
+
+typedef struct
+{
+	uint8_t status;		// Status byte including channel
+	uint8_t data1;
+	uint8_t data2;
+	uint8_t length;		// Total bytes on the wire including status
+	uint8_t cable;		// USB cable, always 0 on TRS
+#ifdef PICOMOD_TRACE
+	uint32_t originUs;	// Dispatch origin when queued, 0 outside of a dispatch
+#endif
+} MidiOutMessage;
+
+typedef struct
+{
+	uint32_t queued;		// Messages accepted into a queue
+	uint32_t sent;			// Messages fully handed to the transport
+	uint32_t coalesced;	// Messages that replaced a stale queued value
+	uint32_t dropped;		// Messages rejected because the queue was full
+	uint32_t runningStatusSaved;	// Status bytes omitted on the wire
+	uint32_t batches;		// DMA transfers or USB bursts handed to the transport
+	uint32_t sysExBytes;	// SysEx bytes sent
+	uint8_t highWater;	// Deepest the normal queue has been
+} MidiOutStats;
+
+typedef struct
+{
+	MidiOutMessage queue[MIDI_OUT_QUEUE_SIZE];
+	uint8_t head;
+	uint8_t count;
+	MidiOutMessage priorityQueue[MIDI_OUT_PRIORITY_QUEUE_SIZE];
+	uint8_t priorityHead;
+	uint8_t priorityCount;
+	// Running status
+	bool useRunningStatus;
+	uint8_t runningStatus;
+	uint32_t lastTxMs;
+	uint32_t pendingSinceUs;	// When the oldest unsent message was queued
+	MidiOutStats stats;
+} MidiOutQueue;
+
+
+void midiOut_Init();
+bool midiOut_Send(MidiPort port, MIDI_NAMESPACE::MidiType type, uint8_t data1, uint8_t data2, uint8_t channel);
+bool midiOut_SendUsb(MidiUsbCable cable, MIDI_NAMESPACE::MidiType type, uint8_t data1, uint8_t data2, uint8_t channel);
+bool midiOut_SendUsbSysEx(MidiUsbCable cable, const uint8_t* data, uint16_t length);
+void midiOut_Process();
+void midiOut_Flush();
+bool midiOut_IsIdle();
+const MidiOutStats* midiOut_GetStats(MidiPort port);
+void midiOut_ResetStats();
+
+#endif /* MIDIOUT_H_ */
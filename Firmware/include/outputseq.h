@@ -0,0 +1,43 @@
+#ifndef OUTPUTSEQ_H_
+#define OUTPUTSEQ_H_
+
+#include "picomod.h"
+
+// Orders the output changes of a trigger dispatch into one transition. Actions only
+// set the wanted state of each output, the changes are driven when the dispatch ends.
+// Changes that need no relay to move are driven at once. Otherwise the transition is
+// (optionally) mute, every relay that changes and the digipot together, wait for the
+// slowest of them to close and stop bouncing, then the analog switch. The transition
+// takes the longest settle time instead of the sum of them.
+// Changes made while a transition is running are driven once it ends.
+// Not interrupt safe, it is only used from the main loop.
+
+//---------- Sequencer Configuration ----------//
+#define OUTPUT_SEQ_RELAY_OPERATE_US		3000		// Coil driven to contacts closed
+#define OUTPUT_SEQ_RELAY_BOUNCE_US		1000		// Contacts bouncing once closed
+#define OUTPUT_SEQ_ANALOG_SWITCH_US		50			// Analog switch on/off time
+// Set on boards where the analog switch mutes the audio path. It is then driven to
+// OUTPUT_SEQ_MUTE_LEVEL while relays move and to its wanted state afterwards
+#define OUTPUT_SEQ_MUTE						0
+#define OUTPUT_SEQ_MUTE_LEVEL				0
+
+
+//------------------ Types -----------------//
+typedef struct
+{
+	uint32_t immediate;				// Dispatches driven without a relay moving
+	uint32_t transitions;			// Dispatches sequenced around moving relays
+	uint32_t deferred;				// Dispatches that arrived during a transition
+	uint32_t maxTransitionUs;		// Longest transition, first change to the last output settled
+} OutputSeqStats;
+
+
+void outputSeq_Init();
+void outputSeq_Set(OutputTarget target, uint8_t level);
+void outputSeq_SetDigipot(uint16_t value);
+void outputSeq_Commit();
+void outputSeq_Process();
+bool outputSeq_IsIdle();
+const OutputSeqStats* outputSeq_GetStats();
+
+#endif /* OUTPUTSEQ_H_ */
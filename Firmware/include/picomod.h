@@ -6,10 +6,17 @@
 #include "mcp41xx.h"
 #include "MIDI.h"
 #include "Adafruit_TinyUSB.h"
-#include "EEPROM.h"
 #include "buttons.h"
 #include "Adafruit_NeoPixel.h"
 #include "ArduinoJson.h"
+#include "expinput.h"
+#include "midiout.h"
+#include "trace.h"
+#include "memstats.h"
+#include "storage.h"
+#include "serialrx.h"
+#include "controltick.h"
+#include <limits>
 
 
 //------------- Pin Definitions -------------//
@@ -36,32 +43,95 @@
 #define GP6_PIN         	28
 #define GP7_PIN         	29
 
+// Analog capable general purpose pins (ADC0-ADC2)
+#define EXP1_PIN				GP4_PIN
+#define EXP2_PIN				GP5_PIN
+#define EXP3_PIN				GP6_PIN
+
 // UI
 #define LED_PIN				17
 
 
 //----------- Config Stack Sizes -----------//
+// Capacities a board variant may override from its build_flags. Everything sized
+// from them, from the storage layout to the JSON buffers, follows at compile time
+// and the Capacity Checks below reject values the stored types cannot index
+#ifndef NUM_PRESETS
 #define NUM_PRESETS				128
+#endif
+#ifndef NUM_SWITCH_ACTIONS
 #define NUM_SWITCH_ACTIONS		16
+#endif
 #define DEVICE_NAME_LEN			16
 #define NUM_SWITCHES				2
-#define JSON_RX_BUFFER_SIZE	1024
+#define SWITCH_EVENT_QUEUE_SIZE	8		// Switch events waiting for the main loop
+// Longest serial frame, about 240 characters per action with every field named.
+// A full preset from the editor is about 2.3KB
+#define JSON_RX_BUFFER_SIZE	(256 + NUM_SWITCH_ACTIONS * 240)
+// Shared by every JSON packet, sized for a full preset with every member of every action:
+// the action, its trigger and its event, plus the "n" of a patch
+#define JSON_ARENA_SIZE			(JSON_OBJECT_SIZE(11) + JSON_ARRAY_SIZE(NUM_SWITCH_ACTIONS) \
+										+ NUM_SWITCH_ACTIONS * (JSON_OBJECT_SIZE(8) + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(5)))
+#define NUM_EXP_INPUTS			3
 
 
 //-------------- Config Flags --------------//
-#define DEVICE_CONFIGURED_VALUE 114
+// Changed whenever the stored layout changes, older layouts are reset to the defaults
+#define DEVICE_CONFIGURED_VALUE 117
 #define DEFAULT_DEVICE_NAME		"New Pico Mod"
 
+#ifndef NUM_LEDS
 #define NUM_LEDS						12
+#endif
 
 
 //------------------ Types -----------------//
+// Serial commands, one per frame. The names are in serialCommandSchema (schema.h)
+typedef enum
+{
+	CommandSendGlobal = 0,
+	CommandSendPreset,
+	CommandPatchPreset,
+	CommandReceivePreset,
+	CommandReceiveGlobal,
+	CommandExpCalStart,
+	CommandExpCalEnd,
+	CommandMidiStats,
+	CommandMemory,
+	CommandTrace,
+	CommandTraceReset,
+	CommandLoopStats,
+	CommandManifest,
+	CommandPatchBlock,
+	CommandPool,
+	CommandFlashStats,
+	NUM_SERIAL_COMMANDS
+} SerialCommand;
+
+// Every command frame gets exactly one reply line, in the order the frames arrived
+typedef enum
+{
+	CommandOk,
+	CommandError,
+	CommandReplied		// The handler sent its own JSON packet line
+} CommandResult;
+
 typedef enum
 {
-	ParsingGlobal,
-	ParsingPreset,
-	ParsingReady
-} ParsingStatus;
+	ExpInputOff = 0,
+	ExpInputCC,
+	ExpInputCC14,
+	ExpInputDigipot
+} ExpInputMode;
+
+typedef struct
+{
+	ExpInputMode mode;
+	uint8_t channel;
+	uint8_t ccNumber;		// MSB controller for 14-bit mode, LSB is sent on ccNumber + 32
+	uint16_t calMin;		// Raw 12-bit ADC reading at heel down
+	uint16_t calMax;		// Raw 12-bit ADC reading at toe down
+} ExpInputConfig;
 
 typedef struct
 {
@@ -69,14 +139,23 @@ typedef struct
 	uint8_t midiChannel;
 	uint8_t currentPreset;
 	char deviceName[DEVICE_NAME_LEN+1];
+	ExpInputConfig expInputs[NUM_EXP_INPUTS];
 } GlobalConfig;
 
+typedef enum
+{
+	MidiDestTrs = 0x01,
+	MidiDestUsb = 0x02,
+	MidiDestAll = MidiDestTrs | MidiDestUsb
+} MidiDestination;
+
 typedef struct
 {
 	uint8_t channel;
 	MIDI_NAMESPACE::MidiType type;
 	uint8_t data1;
 	uint8_t data2;
+	uint8_t destination;		// MidiDestination mask. 0 is treated as TRS only
 } MidiMessage;
 
 typedef struct
@@ -145,6 +224,8 @@ typedef enum
 	TriggerNone
 } TriggerType;
 
+#define NUM_TRIGGER_TYPES			(TriggerNone + 1)
+
 
 typedef struct
 {
@@ -164,13 +245,49 @@ typedef struct
 	TriggerValue value;
 } ActionTrigger;
 
+// Optional per action logic, evaluated against the runtime state when triggered
+typedef enum
+{
+	ConditionAlways = 0,
+	ConditionBypassOn,
+	ConditionBypassOff,
+	ConditionAuxOn,
+	ConditionAuxOff,
+	ConditionAnalogSwitchOn,
+	ConditionAnalogSwitchOff,
+	ConditionValueAbove,			// Triggering value above conditionValue
+	ConditionValueBelow,
+	ConditionValueEquals,
+	NUM_ACTION_CONDITIONS
+} ActionCondition;
+
+// How the value sent by a MIDI or expression event is derived from the triggering value.
+// The event's own value is the operand. Results are clamped to 0 - 127
+typedef enum
+{
+	ValueFixed = 0,				// The event's own value
+	ValuePassthrough,				// The triggering value
+	ValueAdd,						// Triggering value plus the event's value
+	ValueSubtract,					// Triggering value minus the event's value
+	ValueInvert,					// 127 minus the triggering value
+	ValueScale,						// Triggering value scaled by the event's value / 127
+	NUM_ACTION_VALUE_OPS
+} ActionValueOp;
+
+// The logic fields use the bytes that padded the 32-bit event type,
+// so actions saved before they existed read as ConditionAlways and ValueFixed
 typedef struct
 {
 	ActionTrigger trigger;
-	ActionEventType type;
+	uint8_t type;					// ActionEventType
+	uint8_t condition;			// ActionCondition
+	uint8_t conditionValue;
+	uint8_t valueOp;				// ActionValueOp
 	ActionEvent event;
 } Action;
 
+static_assert(sizeof(Action) == 20 && offsetof(Action, event) == 12, "Action is part of the stored preset format");
+
 typedef struct
 {
 	uint32_t id;
@@ -184,21 +301,48 @@ typedef struct
 	uint8_t auxRelayState;
 } Preset;
 
+// Runtime state of the active preset. Loaded from the stored preset on every
+// change so the stored preset itself is never modified while it is in use
+typedef struct
+{
+	uint16_t expValue;
+	uint8_t switch1State;
+	uint8_t switch2State;
+	uint8_t analogSwitchState;
+	uint8_t bypassRelayState;
+	uint8_t auxRelayState;
+} PresetState;
+
+//------------- Capacity Checks -------------//
+// True when every index below count fits the field's type, so the field and
+// loop counters of the same type reach all of them and still terminate
+template<typename Field>
+constexpr bool fitsIndex(size_t count)
+{
+	return count >= 1 && count <= std::numeric_limits<Field>::max();
+}
+
+static_assert(fitsIndex<decltype(GlobalConfig::currentPreset)>(NUM_PRESETS), "NUM_PRESETS must fit the 8 bit preset index");
+static_assert(fitsIndex<decltype(Preset::numActions)>(NUM_SWITCH_ACTIONS), "NUM_SWITCH_ACTIONS must fit the 8 bit action count");
+static_assert(fitsIndex<uint8_t>(NUM_LEDS), "NUM_LEDS must fit an 8 bit LED index");
+static_assert(TriggerSwitch1 + NUM_SWITCHES == TriggerGpio1, "Each switch needs its own trigger type");
+
 //------------- Global Variables -------------/
 extern MIDI_NAMESPACE::MidiInterface<MIDI_NAMESPACE::SerialMIDI<HardwareSerial>> trsMidi;
 extern MIDI_NAMESPACE::MidiInterface<MIDI_NAMESPACE::SerialMIDI<Adafruit_USBD_MIDI>> usbMidi;
+extern Adafruit_USBD_MIDI usb_midi;
 
 extern Button switches[NUM_SWITCHES];
 extern MCP41 digipot;
 extern GlobalConfig globalConfig;
-extern Preset preset;
+extern const Preset* preset;
+extern PresetState presetState;
 extern Adafruit_NeoPixel leds;
-extern ParsingStatus parsingStatus;
-extern char serialRxBuffer[];
 
 //------------------ System ------------------//
 void picoMod_Init();
-void picoMod_SerialRx(uint16_t len);
+void picoMod_Process();
+void picoMod_SerialRx(char* frame, uint16_t len);
 
 //------------------ GPIO -------------------//
 void relayBypassOn();
@@ -218,16 +362,20 @@ void readCurrentPreset();
 void saveCurrentPreset();
 void readGlobalConfig();
 void saveGlobalConfig();
+void saveCurrentPresetIndex();
 void presetUp();
 void presetDown();
 void goToPreset(uint8_t newPreset);
 
 //----------- Action Handling -----------//
 void processTriggers(TriggerType triggerType);
-void processAction(Action* action);
-void processMidiActionEvent(ActionEvent* event);
-void processExpActionEvent(ActionEvent* event);
-void processOutputActionEvent(ActionEvent* event);
-void processLedActionEvent(ActionEvent* event);
+void processTriggerInput(TriggerType triggerType, uint8_t number, uint8_t value);
+
+//------------ JSON Handling ------------//
+bool processGlobalConfigPacket(char* buffer);
+bool processPresetPacket(char* buffer);
+bool processPresetPatchPacket(char* buffer);
+void sendGlobalConfigPacket();
+void sendPresetPacket(uint8_t presetIndex);
 
 #endif /* PICOMOD_H_ */
@@ -0,0 +1,32 @@
+#ifndef PRESETBANK_H_
+#define PRESETBANK_H_
+
+#include "picomod.h"
+#include "actioncode.h"
+
+// Keeps the active preset and its neighbours resident in RAM, already compiled.
+// Changing to a resident preset only swaps a pointer. The slot that falls out of
+// the window is refilled with the new neighbour later from the main loop.
+
+//------------ Bank Configuration ------------//
+#define PRESET_BANK_SLOTS			3		// Active, next and previous
+
+
+//------------------ Types -----------------//
+typedef struct
+{
+	Preset preset;
+	ActionProgram program;		// The actions compiled per trigger
+	uint8_t index;
+	bool valid;
+} PresetSlot;
+
+
+void presetBank_Init(uint8_t index);
+const PresetSlot* presetBank_Select(uint8_t index);
+void presetBank_Process();
+void presetBank_Invalidate(uint8_t index);
+uint8_t presetBank_Next(uint8_t index);
+uint8_t presetBank_Previous(uint8_t index);
+
+#endif /* PRESETBANK_H_ */
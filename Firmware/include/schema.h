@@ -0,0 +1,319 @@
+#ifndef SCHEMA_H_
+#define SCHEMA_H_
+
+#include "picomod.h"
+
+// Lookup tables between the human readable names used by the JSON schema
+// (docs/interface-example.json) and the firmware enums.
+// Each table finds a perfect hash seed for both directions at compile time, so a lookup
+// is one hash and at most one strcmp. A table that cannot be hashed fails the build.
+
+//------------ Schema Configuration ------------//
+#define SCHEMA_MAX_SEED				4096		// Seeds tried per table before giving up
+#define SCHEMA_COLOUR_LEN			6			// "rrggbb", an optional leading '#' is accepted
+
+
+//------------------ Types -----------------//
+typedef struct
+{
+	const char* name;
+	uint8_t value;
+} SchemaEntry;
+
+template<size_t N>
+class SchemaTable
+{
+public:
+	static constexpr size_t SLOTS = N <= 2 ? 4 : (size_t)1 << (32 - __builtin_clz((uint32_t)(2 * N - 1)));
+
+	template<typename... Entries>
+	constexpr SchemaTable(Entries... list) : entries{list...}, nameSeed(0), valueSeed(0), nameSlots{}, valueSlots{}
+	{
+		static_assert(sizeof...(Entries) == N, "Schema table size mismatch");
+		nameSeed = findSeed(true);
+		valueSeed = findSeed(false);
+		fill(nameSlots, nameSeed, true);
+		fill(valueSlots, valueSeed, false);
+	}
+
+	constexpr bool valid() const
+	{
+		return nameSeed < SCHEMA_MAX_SEED && valueSeed < SCHEMA_MAX_SEED;
+	}
+
+	// Returns false if the name is not part of the table
+	bool toValue(const char* name, uint8_t* value) const
+	{
+		uint8_t slot = nameSlots[hashName(name, nameSeed) & (SLOTS - 1)];
+		if(slot == 0 || strcmp(entries[slot - 1].name, name) != 0)
+		{
+			return false;
+		}
+		*value = entries[slot - 1].value;
+		return true;
+	}
+
+	// Returns NULL if the value has no name
+	const char* toName(uint8_t value) const
+	{
+		uint8_t slot = valueSlots[hashValue(value, valueSeed) & (SLOTS - 1)];
+		if(slot == 0 || entries[slot - 1].value != value)
+		{
+			return NULL;
+		}
+		return entries[slot - 1].name;
+	}
+
+private:
+	SchemaEntry entries[N];
+	uint32_t nameSeed;
+	uint32_t valueSeed;
+	uint8_t nameSlots[SLOTS];		// Entry index + 1, 0 is an empty slot
+	uint8_t valueSlots[SLOTS];
+
+	// FNV-1a with the seed mixed into the offset basis
+	static constexpr uint32_t hashName(const char* name, uint32_t seed)
+	{
+		uint32_t hash = 2166136261u ^ (seed * 0x9E3779B9u);
+		while(*name)
+		{
+			hash = (hash ^ (uint8_t)*name++) * 16777619u;
+		}
+		return hash ^ (hash >> 15);
+	}
+
+	static constexpr uint32_t hashValue(uint8_t value, uint32_t seed)
+	{
+		uint32_t hash = ((2166136261u ^ (seed * 0x9E3779B9u)) ^ value) * 16777619u;
+		return hash ^ (hash >> 15);
+	}
+
+	constexpr uint32_t slotOf(size_t index, uint32_t seed, bool byName) const
+	{
+		return (byName ? hashName(entries[index].name, seed) : hashValue(entries[index].value, seed)) & (SLOTS - 1);
+	}
+
+	constexpr uint32_t findSeed(bool byName) const
+	{
+		for(uint32_t seed = 0; seed < SCHEMA_MAX_SEED; seed++)
+		{
+			bool used[SLOTS] = {};
+			bool collision = false;
+			for(size_t i = 0; i < N && !collision; i++)
+			{
+				uint32_t slot = slotOf(i, seed, byName);
+				collision = used[slot];
+				used[slot] = true;
+			}
+			if(!collision)
+			{
+				return seed;
+			}
+		}
+		return SCHEMA_MAX_SEED;
+	}
+
+	constexpr void fill(uint8_t* slots, uint32_t seed, bool byName)
+	{
+		if(seed >= SCHEMA_MAX_SEED)
+		{
+			return;
+		}
+		for(size_t i = 0; i < N; i++)
+		{
+			slots[slotOf(i, seed, byName)] = i + 1;
+		}
+	}
+};
+
+template<typename... Entries>
+SchemaTable(Entries... list) -> SchemaTable<sizeof...(Entries)>;
+
+
+//------------------ Tables -----------------//
+inline constexpr SchemaTable triggerTypeSchema
+{
+	SchemaEntry{"switch1", TriggerSwitch1},
+	SchemaEntry{"switch2", TriggerSwitch2},
+	SchemaEntry{"gpio1", TriggerGpio1},
+	SchemaEntry{"gpio2", TriggerGpio2},
+	SchemaEntry{"gpio3", TriggerGpio3},
+	SchemaEntry{"gpio4", TriggerGpio4},
+	SchemaEntry{"gpio5", TriggerGpio5},
+	SchemaEntry{"gpio6", TriggerGpio6},
+	SchemaEntry{"gpio7", TriggerGpio7},
+	SchemaEntry{"midiCC", TriggerCC},
+	SchemaEntry{"enterBank", TriggerEnterBank},
+	SchemaEntry{"exitBank", TriggerExitBank},
+	SchemaEntry{"boot", TriggerBoot},
+	SchemaEntry{"none", TriggerNone}
+};
+
+inline constexpr SchemaTable buttonStateSchema
+{
+	SchemaEntry{"none", ButtonNoEvent},
+	SchemaEntry{"press", ButtonPress},
+	SchemaEntry{"release", ButtonRelease},
+	SchemaEntry{"hold", ButtonHold}
+};
+
+inline constexpr SchemaTable actionEventSchema
+{
+	SchemaEntry{"midi", ActionEventMidi},
+	SchemaEntry{"exp", ActionEventExp},
+	SchemaEntry{"output", ActionEventOutput},
+	SchemaEntry{"led", ActionEventLed}
+};
+
+inline constexpr SchemaTable outputTargetSchema
+{
+	SchemaEntry{"bypassRelay", OutputBypassRelay},
+	SchemaEntry{"auxRelay", OutputAuxRelay},
+	SchemaEntry{"analogSwitch", OutputAnalogSwitch},
+	SchemaEntry{"gpio", OutputGpio}
+};
+
+inline constexpr SchemaTable outputValueSchema
+{
+	SchemaEntry{"on", OutputOn},
+	SchemaEntry{"off", OutputOff},
+	SchemaEntry{"toggle", OutputToggle}
+};
+
+inline constexpr SchemaTable midiDestinationSchema
+{
+	SchemaEntry{"trs", MidiDestTrs},
+	SchemaEntry{"usb", MidiDestUsb},
+	SchemaEntry{"all", MidiDestAll}
+};
+
+inline constexpr SchemaTable actionConditionSchema
+{
+	SchemaEntry{"always", ConditionAlways},
+	SchemaEntry{"bypassOn", ConditionBypassOn},
+	SchemaEntry{"bypassOff", ConditionBypassOff},
+	SchemaEntry{"auxOn", ConditionAuxOn},
+	SchemaEntry{"auxOff", ConditionAuxOff},
+	SchemaEntry{"analogSwitchOn", ConditionAnalogSwitchOn},
+	SchemaEntry{"analogSwitchOff", ConditionAnalogSwitchOff},
+	SchemaEntry{"valueAbove", ConditionValueAbove},
+	SchemaEntry{"valueBelow", ConditionValueBelow},
+	SchemaEntry{"valueEquals", ConditionValueEquals}
+};
+
+inline constexpr SchemaTable actionValueSchema
+{
+	SchemaEntry{"fixed", ValueFixed},
+	SchemaEntry{"passthrough", ValuePassthrough},
+	SchemaEntry{"add", ValueAdd},
+	SchemaEntry{"subtract", ValueSubtract},
+	SchemaEntry{"invert", ValueInvert},
+	SchemaEntry{"scale", ValueScale}
+};
+
+inline constexpr SchemaTable expInputModeSchema
+{
+	SchemaEntry{"off", ExpInputOff},
+	SchemaEntry{"cc", ExpInputCC},
+	SchemaEntry{"cc14", ExpInputCC14},
+	SchemaEntry{"digipot", ExpInputDigipot}
+};
+
+inline constexpr SchemaTable midiTypeSchema
+{
+	SchemaEntry{"noteOff", MIDI_NAMESPACE::NoteOff},
+	SchemaEntry{"noteOn", MIDI_NAMESPACE::NoteOn},
+	SchemaEntry{"afterTouchPoly", MIDI_NAMESPACE::AfterTouchPoly},
+	SchemaEntry{"controlChange", MIDI_NAMESPACE::ControlChange},
+	SchemaEntry{"programChange", MIDI_NAMESPACE::ProgramChange},
+	SchemaEntry{"afterTouchChannel", MIDI_NAMESPACE::AfterTouchChannel},
+	SchemaEntry{"pitchBend", MIDI_NAMESPACE::PitchBend},
+	SchemaEntry{"systemExclusive", MIDI_NAMESPACE::SystemExclusive},
+	SchemaEntry{"timeCodeQuarterFrame", MIDI_NAMESPACE::TimeCodeQuarterFrame},
+	SchemaEntry{"songPosition", MIDI_NAMESPACE::SongPosition},
+	SchemaEntry{"songSelect", MIDI_NAMESPACE::SongSelect},
+	SchemaEntry{"tuneRequest", MIDI_NAMESPACE::TuneRequest},
+	SchemaEntry{"clock", MIDI_NAMESPACE::Clock},
+	SchemaEntry{"start", MIDI_NAMESPACE::Start},
+	SchemaEntry{"continue", MIDI_NAMESPACE::Continue},
+	SchemaEntry{"stop", MIDI_NAMESPACE::Stop},
+	SchemaEntry{"activeSensing", MIDI_NAMESPACE::ActiveSensing},
+	SchemaEntry{"systemReset", MIDI_NAMESPACE::SystemReset}
+};
+
+inline constexpr SchemaTable serialCommandSchema
+{
+	SchemaEntry{"sendGlobal", CommandSendGlobal},
+	SchemaEntry{"sendPreset", CommandSendPreset},
+	SchemaEntry{"patchPreset", CommandPatchPreset},
+	SchemaEntry{"receivePreset", CommandReceivePreset},
+	SchemaEntry{"receiveGlobal", CommandReceiveGlobal},
+	SchemaEntry{"expCalStart", CommandExpCalStart},
+	SchemaEntry{"expCalEnd", CommandExpCalEnd},
+	SchemaEntry{"midiStats", CommandMidiStats},
+	SchemaEntry{"memory", CommandMemory},
+	SchemaEntry{"trace", CommandTrace},
+	SchemaEntry{"traceReset", CommandTraceReset},
+	SchemaEntry{"loopStats", CommandLoopStats},
+	SchemaEntry{"manifest", CommandManifest},
+	SchemaEntry{"patchBlock", CommandPatchBlock},
+	SchemaEntry{"pool", CommandPool},
+	SchemaEntry{"flashStats", CommandFlashStats}
+};
+
+static_assert(triggerTypeSchema.valid(), "No perfect hash for the trigger types");
+static_assert(buttonStateSchema.valid(), "No perfect hash for the button states");
+static_assert(actionEventSchema.valid(), "No perfect hash for the action event types");
+static_assert(outputTargetSchema.valid(), "No perfect hash for the output targets");
+static_assert(outputValueSchema.valid(), "No perfect hash for the output values");
+static_assert(midiDestinationSchema.valid(), "No perfect hash for the MIDI destinations");
+static_assert(actionConditionSchema.valid(), "No perfect hash for the action conditions");
+static_assert(actionValueSchema.valid(), "No perfect hash for the action value operations");
+static_assert(expInputModeSchema.valid(), "No perfect hash for the expression input modes");
+static_assert(midiTypeSchema.valid(), "No perfect hash for the MIDI types");
+static_assert(serialCommandSchema.valid(), "No perfect hash for the serial commands");
+
+
+//------------------ JSON Fields -----------------//
+// Enum fields accept either the schema name or the raw number older editors send.
+// A missing field reads as the given default. A name the table does not know also
+// reads as the default and clears known, so the packet can be refused
+template<size_t N>
+uint8_t schema_Read(JsonVariantConst field, const SchemaTable<N>& table, uint8_t fallback, bool* known = NULL)
+{
+	if(field.is<const char*>())
+	{
+		uint8_t value;
+		if(table.toValue(field.as<const char*>(), &value))
+		{
+			return value;
+		}
+		if(known)
+		{
+			*known = false;
+		}
+		return fallback;
+	}
+	return field | fallback;
+}
+
+// Values without a name are written as numbers so nothing is lost.
+// Takes the member/element proxy by value so assigning creates the field
+template<typename Field, size_t N>
+void schema_Write(Field field, const SchemaTable<N>& table, uint8_t value)
+{
+	const char* name = table.toName(value);
+	if(name)
+	{
+		field = name;
+	}
+	else
+	{
+		field = value;
+	}
+}
+
+bool schema_ParseColour(const char* str, uint32_t* colour);
+void schema_FormatColour(uint32_t colour, char* str);
+
+#endif /* SCHEMA_H_ */
@@ -0,0 +1,34 @@
+#ifndef SERIALRX_H_
+#define SERIALRX_H_
+
+#include "Arduino.h"
+
+// Framed receiver for the USB CDC configuration link.
+// Incoming bytes are moved into a ring buffer as they arrive and split into frames at
+// each newline, so a packet spread over several USB transfers arrives whole and several
+// requests may be sent back to back. Each complete frame is handed to picoMod_SerialRx().
+// Editors that do not terminate their frames are still served: a partial frame that
+// has been idle for SERIAL_RX_IDLE_MS is taken as complete.
+
+//------------ Receiver Configuration ------------//
+#define SERIAL_RX_RING_SIZE			2048		// Must be a power of two
+#define SERIAL_RX_IDLE_MS				50
+#define SERIAL_RX_FRAMES_PER_CALL	1			// Keeps a burst of requests from starving the MIDI output
+
+
+//------------------ Types -----------------//
+typedef struct
+{
+	uint32_t frames;			// Frames handed to the dispatcher
+	uint32_t idleFrames;		// Frames ended by the idle timeout instead of a newline
+	uint32_t oversized;		// Frames discarded for not fitting JSON_RX_BUFFER_SIZE
+	uint16_t ringHighWater;	// Deepest the ring buffer has been
+} SerialRxStats;
+
+
+void serialRx_Init();
+void serialRx_Process();
+bool serialRx_Pending();
+const SerialRxStats* serialRx_GetStats();
+
+#endif /* SERIALRX_H_ */
@@ -0,0 +1,67 @@
+#ifndef STORAGE_H_
+#define STORAGE_H_
+
+#include "Arduino.h"
+
+// Record storage in the flash filesystem region (board_build.filesystem_size).
+// Records are read straight from the XIP mapped flash. Writes are staged in a small
+// cache of 4KB sector buffers and only sectors whose contents changed are erased
+// and programmed on commit. An erase is skipped when the change only clears bits.
+// A content hash of the global config is kept in RAM, computed at boot and updated
+// as it is written, so the editor can tell whether it differs from its copy.
+// Presets and action blocks are hashed by the action pool.
+// The current preset changes far more often than anything else, so it is not rewritten
+// with the global config. Each change is appended to a log sector one byte at a time,
+// and that sector is only erased once every byte of it has been used.
+// Erases, page programs and the time flash writes block the core are counted
+// since boot, with the erases of each sector for the wear they cause. The part usually
+// erases and programs far faster than its rated maximum, so the longest stall is also
+// given at the maximum times.
+
+//------------ Storage Configuration ------------//
+#define STORAGE_SECTOR_SIZE		4096
+#define STORAGE_PAGE_SIZE			256
+#define STORAGE_CACHE_SECTORS		2		// Sector buffers held in RAM for staged writes
+#define STORAGE_REGION_SIZE		(1024 * 1024)	// board_build.filesystem_size in platformio.ini
+#define STORAGE_ENDURANCE_CYCLES	100000	// Erase cycles each sector is rated for
+#define STORAGE_ERASE_WORST_US	400000	// Datasheet maximum per sector erase
+#define STORAGE_PROGRAM_WORST_US	3000		// Datasheet maximum per page program
+#define STORAGE_HASH_BASIS		2166136261u	// FNV-1a offset basis
+
+
+//------------------ Types -----------------//
+typedef enum
+{
+	StorageRecordGlobal = 0,
+	StorageRecordPreset,
+	StorageRecordAction				// Action pool block
+} StorageRecordType;
+
+typedef struct
+{
+	uint32_t flushes;				// Sectors written back to flash
+	uint32_t erases;
+	uint32_t pagePrograms;
+	uint32_t bytesProgrammed;
+	uint64_t blockedUs;			// Time with flash unavailable and interrupts off
+	uint32_t maxBlockedUs;		// Longest single stall
+	uint32_t maxWorstCaseUs;		// Longest single stall had the part taken its maximum times
+	uint16_t hottestSector;		// The sector erased most often
+	uint32_t hottestErases;
+} StorageStats;
+
+
+void storage_Init();
+bool storage_Read(StorageRecordType type, uint16_t index, void* data, size_t size);
+bool storage_Write(StorageRecordType type, uint16_t index, const void* data, size_t size);
+void storage_Commit();
+uint32_t storage_RecordOffset(StorageRecordType type, uint16_t index);
+uint32_t storage_RecordHash(StorageRecordType type, uint16_t index);
+uint32_t storage_Hash(const void* data, size_t size, uint32_t hash = STORAGE_HASH_BASIS);
+bool storage_ReadCurrentPreset(uint8_t* index);
+void storage_WriteCurrentPreset(uint8_t index);
+void storage_ResetCurrentPreset(uint8_t index);
+const StorageStats* storage_GetStats();
+void storage_ResetStats();
+
+#endif /* STORAGE_H_ */
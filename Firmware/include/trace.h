@@ -0,0 +1,89 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "Arduino.h"
+
+// Latency tracing is only compiled in when PICOMOD_TRACE is defined (see env:trace).
+// Without it every TRACE_ macro expands to nothing.
+
+//------------- Trace Configuration -------------//
+#define TRACE_RING_SIZE				128		// Must be a power of two
+#define TRACE_HIST_BUCKETS			64			// 4 buckets per octave, covers up to ~131ms
+#define TRACE_NUM_INPUTS			2
+
+
+//------------------ Types -----------------//
+typedef enum
+{
+	TracePathSwitchEdge = 0,	// Footswitch edge to trigger dispatch
+	TracePathTriggers,			// Whole trigger dispatch
+	TracePathActionMidi,
+	TracePathActionExp,
+	TracePathActionOutput,
+	TracePathActionLed,
+	TracePathPresetChange,		// Preset change request to preset loaded
+	TracePathFlashCommit,
+	TracePathEdgeToRelay,		// Dispatch origin to a relay coil being driven
+	TracePathEdgeToDigipot,		// Dispatch origin to the digipot write completing
+	TracePathEdgeToMidiTrs,		// Dispatch origin to the message being handed to the UART DMA
+	TracePathEdgeToMidiUsb,		// Dispatch origin to the packet being handed to TinyUSB
+	TracePathEdgeToAnalogSwitch,	// Dispatch origin to the analog switch flipping
+	NUM_TRACE_PATHS
+} TracePath;
+
+typedef struct
+{
+	uint32_t sequence;			// Written last, index + 1. Lets the reader reject torn entries
+	uint32_t timestamp;			// End of the traced span
+	uint32_t duration;
+	uint8_t path;
+} TraceEntry;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t buckets[TRACE_HIST_BUCKETS];
+} TraceHistogram;
+
+
+#ifdef PICOMOD_TRACE
+
+void trace_Record(TracePath path, uint32_t startUs, uint32_t endUs);
+void trace_InputEdge(uint8_t input);
+uint32_t trace_InputEdgeTime(uint8_t input);
+void trace_BeginDispatch(uint32_t originUs);
+void trace_BeginInputDispatch(uint8_t input);
+void trace_EndDispatch();
+uint32_t trace_Origin();
+void trace_Output(TracePath path);
+void trace_OutputFrom(TracePath path, uint32_t originUs);
+void trace_Reset();
+const TraceHistogram* trace_GetHistogram(TracePath path);
+uint32_t trace_Percentile(TracePath path, uint8_t percentile);
+uint16_t trace_ReadRecent(TraceEntry* entries, uint16_t maxEntries);
+const char* trace_PathName(TracePath path);
+
+#define TRACE_INPUT_EDGE(input)				trace_InputEdge(input)
+#define TRACE_DISPATCH_BEGIN(originUs)		trace_BeginDispatch(originUs)
+#define TRACE_DISPATCH_INPUT(input)			trace_BeginInputDispatch(input)
+#define TRACE_DISPATCH_END()					trace_EndDispatch()
+#define TRACE_BEGIN(name)						uint32_t name = time_us_32()
+#define TRACE_END(path, name)					trace_Record(path, name, time_us_32())
+#define TRACE_OUTPUT(path)						trace_Output(path)
+
+#else
+
+#define TRACE_INPUT_EDGE(input)
+#define TRACE_DISPATCH_BEGIN(originUs)
+#define TRACE_DISPATCH_INPUT(input)
+#define TRACE_DISPATCH_END()
+#define TRACE_BEGIN(name)
+#define TRACE_END(path, name)
+#define TRACE_OUTPUT(path)
+
+#endif /* PICOMOD_TRACE */
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,598 @@
+// Deterministic trace replay of the whole device on the host.
+// Build and run with: pio run -e sim && .pio/build/sim/program input.trace [output.jsonl]
+//   --loop-us N    Simulated duration of one main loop pass (default 10)
+//   --tail-us N    Time run after the last input so queued output can drain (default 100000)
+//   --expect F     Compare the run against the recorded output F of an earlier run, and exit
+//                  with 1 at the first difference. Times, flash operations and the summary
+//                  are left out, so only what the device did and in which order is compared
+//                  Each sim/<name>.expected is the recording of sim/<name>.trace
+//
+// The firmware engine runs against the host/ hardware shims on a simulated clock, which
+// only moves by the loop period, the firmware's own delays, flash erase and program
+// times and idle sleeps, which last until the next control tick or input. Code is taken
+// as running in zero time, so the latencies reported are those of the polling, queueing,
+// deadlines, flash stalls and wire speed. Inputs are delivered at the start of the first
+// loop pass at or after their time, their latency counts from the time in the trace.
+// The same trace always gives the same output.
+//
+// Trace lines, microseconds from the end of boot and never decreasing. # starts a comment:
+//   <us> switch <1|2> <press|release>
+//   <us> trs <hex bytes>            MIDI arriving on the TRS input
+//   <us> usb <hex bytes>            MIDI arriving from the USB host
+//   <us> serial <text>              One configuration frame, the newline is added
+//   <us> usbMount <0|1>
+//
+// Every input and output is printed as one JSON object per line with its simulated time
+// since power on, followed by a summary with the output counts, the input to first
+// output latency and the flash cost of the trace, with the longest stall at the part's
+// typical and maximum times. The "ready" line marks the end of boot, where the trace
+// starts. The flash lifetime is projected from the sector the trace erases most, as if
+// the trace were repeated until it wears out (see sim/gig.trace).
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include "picomod.h"
+#include "host.h"
+
+#define SIM_DEFAULT_LOOP_US	10
+#define SIM_DEFAULT_TAIL_US	100000
+
+typedef enum
+{
+	SimInputSwitch = 0,
+	SimInputTrs,
+	SimInputUsb,
+	SimInputSerial,
+	SimInputUsbMount,
+	NUM_SIM_INPUTS
+} SimInputType;
+
+typedef struct
+{
+	uint64_t time;
+	SimInputType type;
+	std::vector<uint8_t> data;
+} SimInput;
+
+typedef struct
+{
+	std::vector<uint64_t> latencies;	// Input to first output, for inputs that produced any
+	uint32_t count;
+} SimLatency;
+
+static const char* inputNames[NUM_SIM_INPUTS] = {"switch", "trs", "usb", "serial", "usbMount"};
+static const char* outputNames[] = {"gpio", "digipot", "trs", "usb", "leds", "serial", "flash"};
+static_assert(sizeof(outputNames) / sizeof(outputNames[0]) == NUM_HOST_EVENTS, "One name per host event");
+
+static std::vector<SimInput> inputs;
+static FILE* output = stdout;
+static uint64_t loopUs = SIM_DEFAULT_LOOP_US;
+static uint64_t tailUs = SIM_DEFAULT_TAIL_US;
+
+// Output capture
+static std::string serialLine;
+static uint64_t serialLineTime;
+static uint32_t outputCounts[NUM_HOST_EVENTS];
+static SimLatency latency[NUM_SIM_INPUTS];
+static int lastInput = -1;				// Type of the input outputs are attributed to
+static uint64_t lastInputTime;
+static bool lastInputAnswered;
+
+// Private Function Prototypes
+static bool loadTrace(const char* path);
+static bool parseHex(const char* text, std::vector<uint8_t>* bytes);
+static bool compareLine(const std::string& line, std::string* key);
+static bool checkExpected(const char* path, const char* run);
+static void applyInput(const SimInput* input, uint64_t arrival);
+static void hostEventHandler(HostEventType type, const uint8_t* data, uint32_t len, uint32_t arg);
+static void recordOutput(HostEventType type);
+static void bootDevice();
+static const char* pinName(uint32_t pin);
+static void printHex(const uint8_t* data, uint32_t len);
+static void printString(const std::string& text);
+static void printSummary(uint64_t traceUs);
+
+
+int main(int argc, char** argv)
+{
+	const char* tracePath = NULL;
+	const char* outputPath = NULL;
+	const char* expectPath = NULL;
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "--loop-us") == 0 && i + 1 < argc)
+		{
+			loopUs = strtoull(argv[++i], NULL, 10);
+		}
+		else if(strcmp(argv[i], "--tail-us") == 0 && i + 1 < argc)
+		{
+			tailUs = strtoull(argv[++i], NULL, 10);
+		}
+		else if(strcmp(argv[i], "--expect") == 0 && i + 1 < argc)
+		{
+			expectPath = argv[++i];
+		}
+		else if(tracePath == NULL)
+		{
+			tracePath = argv[i];
+		}
+		else
+		{
+			outputPath = argv[i];
+		}
+	}
+	if(tracePath == NULL || loopUs == 0)
+	{
+		fprintf(stderr, "Usage: %s [--loop-us N] [--tail-us N] [--expect recorded.jsonl] input.trace [output.jsonl]\n", argv[0]);
+		return 1;
+	}
+	if(!loadTrace(tracePath))
+	{
+		return 1;
+	}
+	FILE* destination = stdout;
+	if(outputPath)
+	{
+		destination = fopen(outputPath, "w");
+		if(destination == NULL)
+		{
+			fprintf(stderr, "Unable to open %s\n", outputPath);
+			return 1;
+		}
+	}
+	// The run is held in memory to be compared once it is complete
+	char* run = NULL;
+	size_t runSize = 0;
+	output = expectPath ? open_memstream(&run, &runSize) : destination;
+
+	fprintf(output, "{\"sim\":\"picomod\",\"fwVersion\":%.1f,\"trace\":", (double)FW_VERSION);
+	printString(tracePath);
+	fprintf(output, ",\"inputs\":%zu,\"loopUs\":%llu}\n", inputs.size(), (unsigned long long)loopUs);
+
+	host_UseSimulatedClock(true);
+	host_SetEventHandler(hostEventHandler);
+	bootDevice();
+	uint64_t start = host_Now();
+	fprintf(output, "{\"t\":%llu,\"out\":\"ready\"}\n", (unsigned long long)start);
+	// Only the trace's own flash use is reported
+	storage_ResetStats();
+
+	uint64_t endTime = start + (inputs.empty() ? 0 : inputs.back().time) + tailUs;
+	size_t next = 0;
+	while(next < inputs.size() || host_Now() < endTime)
+	{
+		while(next < inputs.size() && start + inputs[next].time <= host_Now())
+		{
+			applyInput(&inputs[next], start + inputs[next].time);
+			next++;
+		}
+		// An idle device sleeps until the next input at the latest.
+		// A pass that slept has already taken its time
+		host_SetNextEvent(next < inputs.size() ? start + inputs[next].time : endTime);
+		uint64_t passStart = host_Now();
+		picoMod_Process();
+		// A factory reset or new device configuration reboots
+		if(host_ResetRequested())
+		{
+			fprintf(output, "{\"t\":%llu,\"out\":\"reset\"}\n", (unsigned long long)host_Now());
+			bootDevice();
+		}
+		if(host_Now() == passStart)
+		{
+			host_Advance(loopUs);
+		}
+	}
+
+	printSummary(host_Now() - start);
+	bool matched = true;
+	if(expectPath)
+	{
+		fclose(output);
+		fwrite(run, 1, runSize, destination);
+		matched = checkExpected(expectPath, run);
+		free(run);
+	}
+	if(destination != stdout)
+	{
+		fclose(destination);
+	}
+	return matched ? 0 : 1;
+}
+
+
+//-------------------- Local Functions --------------------//
+static bool loadTrace(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if(file == NULL)
+	{
+		fprintf(stderr, "Unable to open %s\n", path);
+		return false;
+	}
+	char line[JSON_RX_BUFFER_SIZE + 64];
+	uint32_t lineNumber = 0;
+	uint64_t previous = 0;
+	bool ok = true;
+	while(ok && fgets(line, sizeof(line), file))
+	{
+		lineNumber++;
+		line[strcspn(line, "\r\n")] = 0;
+		char* text = line + strspn(line, " \t");
+		if(*text == 0 || *text == '#')
+		{
+			continue;
+		}
+
+		SimInput input;
+		char kind[16];
+		int consumed = 0;
+		unsigned long long time;
+		if(sscanf(text, "%llu %15s %n", &time, kind, &consumed) < 2 || time < previous)
+		{
+			ok = false;
+			break;
+		}
+		input.time = previous = time;
+		const char* args = text + consumed;
+
+		if(strcmp(kind, "switch") == 0)
+		{
+			unsigned index = 0;
+			char state[16] = "";
+			ok = sscanf(args, "%u %15s", &index, state) == 2 && index >= 1 && index <= NUM_SWITCHES
+				&& (strcmp(state, "press") == 0 || strcmp(state, "release") == 0);
+			input.type = SimInputSwitch;
+			input.data = {(uint8_t)(index - 1), (uint8_t)(strcmp(state, "press") == 0)};
+		}
+		else if(strcmp(kind, "trs") == 0 || strcmp(kind, "usb") == 0)
+		{
+			input.type = kind[0] == 't' ? SimInputTrs : SimInputUsb;
+			ok = parseHex(args, &input.data) && !input.data.empty();
+		}
+		else if(strcmp(kind, "serial") == 0)
+		{
+			input.type = SimInputSerial;
+			input.data.assign(args, args + strlen(args));
+			input.data.push_back('\n');
+		}
+		else if(strcmp(kind, "usbMount") == 0)
+		{
+			input.type = SimInputUsbMount;
+			input.data = {(uint8_t)(atoi(args) != 0)};
+		}
+		else
+		{
+			ok = false;
+		}
+		if(ok)
+		{
+			inputs.push_back(input);
+		}
+	}
+	fclose(file);
+	if(!ok)
+	{
+		fprintf(stderr, "%s:%u: bad trace line\n", path, lineNumber);
+	}
+	return ok;
+}
+
+// Space separated byte pairs, "b0 14 7f"
+static bool parseHex(const char* text, std::vector<uint8_t>* bytes)
+{
+	while(*text)
+	{
+		char* end;
+		unsigned long value = strtoul(text, &end, 16);
+		if(end == text || value > 0xFF)
+		{
+			return *(text + strspn(text, " \t")) == 0;
+		}
+		bytes->push_back(value);
+		text = end;
+	}
+	return true;
+}
+
+// The part of an output line a recorded run is compared on, false for lines left out
+static bool compareLine(const std::string& line, std::string* key)
+{
+	if(line.compare(0, 6, "{\"sim\"") == 0 || line.compare(0, 10, "{\"summary\"") == 0
+		|| line.find("\"out\":\"flash\"") != std::string::npos)
+	{
+		return false;
+	}
+	*key = line;
+	if(line.compare(0, 5, "{\"t\":") == 0)
+	{
+		size_t comma = line.find(',');
+		if(comma != std::string::npos)
+		{
+			*key = "{" + line.substr(comma + 1);
+		}
+	}
+	return true;
+}
+
+static bool checkExpected(const char* path, const char* run)
+{
+	std::ifstream expected(path);
+	if(!expected)
+	{
+		fprintf(stderr, "Unable to open %s\n", path);
+		return false;
+	}
+	std::vector<std::string> wanted;
+	std::string line;
+	std::string key;
+	while(std::getline(expected, line))
+	{
+		if(compareLine(line, &key))
+		{
+			wanted.push_back(key);
+		}
+	}
+
+	size_t index = 0;
+	const char* text = run;
+	while(*text)
+	{
+		const char* end = strchr(text, '\n');
+		line.assign(text, end ? end - text : strlen(text));
+		text += line.size() + (end ? 1 : 0);
+		if(!compareLine(line, &key))
+		{
+			continue;
+		}
+		if(index >= wanted.size() || wanted[index] != key)
+		{
+			fprintf(stderr, "%s: differs at entry %zu\n  expected %s\n  got      %s\n", path, index + 1,
+					index < wanted.size() ? wanted[index].c_str() : "(end)", key.c_str());
+			return false;
+		}
+		index++;
+	}
+	if(index < wanted.size())
+	{
+		fprintf(stderr, "%s: run ended before entry %zu\n  expected %s\n", path, index + 1, wanted[index].c_str());
+		return false;
+	}
+	return true;
+}
+
+static void applyInput(const SimInput* input, uint64_t arrival)
+{
+	fprintf(output, "{\"t\":%llu,\"in\":\"%s\"", (unsigned long long)arrival, inputNames[input->type]);
+	switch(input->type)
+	{
+		case SimInputSwitch:
+		fprintf(output, ",\"index\":%u,\"state\":\"%s\"}\n", input->data[0] + 1, input->data[1] ? "press" : "release");
+		break;
+
+		case SimInputTrs:
+		case SimInputUsb:
+		fprintf(output, ",\"bytes\":");
+		printHex(input->data.data(), input->data.size());
+		fprintf(output, "}\n");
+		break;
+
+		case SimInputSerial:
+		fprintf(output, ",\"text\":");
+		printString(std::string(input->data.begin(), input->data.end() - 1));
+		fprintf(output, "}\n");
+		break;
+
+		case SimInputUsbMount:
+		fprintf(output, ",\"mounted\":%u}\n", input->data[0]);
+		break;
+
+		default:
+		break;
+	}
+
+	lastInput = input->type;
+	lastInputTime = arrival;
+	lastInputAnswered = false;
+	latency[input->type].count++;
+
+	switch(input->type)
+	{
+		// The footswitches are active low
+		case SimInputSwitch:
+		host_SetPin(input->data[0] == 0 ? SWITCH1_PIN : SWITCH2_PIN, !input->data[1]);
+		break;
+
+		case SimInputTrs:
+		host_UartInput(input->data.data(), input->data.size());
+		break;
+
+		case SimInputUsb:
+		host_UsbMidiInput(input->data.data(), input->data.size());
+		break;
+
+		case SimInputSerial:
+		host_SerialInput(input->data.data(), input->data.size());
+		break;
+
+		case SimInputUsbMount:
+		host_SetUsbMounted(input->data[0]);
+		break;
+
+		default:
+		break;
+	}
+}
+
+static void hostEventHandler(HostEventType type, const uint8_t* data, uint32_t len, uint32_t arg)
+{
+	uint64_t now = host_Now();
+	// Serial replies are gathered into lines, they are written a piece at a time
+	if(type == HostEventSerial)
+	{
+		for(uint32_t i=0; i<len; i++)
+		{
+			if(serialLine.empty())
+			{
+				serialLineTime = now;
+				recordOutput(type);
+			}
+			if(data[i] == '\n')
+			{
+				fprintf(output, "{\"t\":%llu,\"out\":\"serial\",\"text\":", (unsigned long long)serialLineTime);
+				printString(serialLine);
+				fprintf(output, "}\n");
+				serialLine.clear();
+			}
+			else if(data[i] != '\r')
+			{
+				serialLine.push_back(data[i]);
+			}
+		}
+		return;
+	}
+
+	recordOutput(type);
+	fprintf(output, "{\"t\":%llu,\"out\":\"%s\"", (unsigned long long)now, outputNames[type]);
+	switch(type)
+	{
+		case HostEventGpio:
+		fprintf(output, ",\"pin\":%u,\"name\":\"%s\",\"level\":%u}\n", arg, pinName(arg), data[0]);
+		break;
+
+		case HostEventLeds:
+		fprintf(output, ",\"colours\":[");
+		for(uint32_t i=0; i<arg; i++)
+		{
+			fprintf(output, "%s\"%06x\"", i ? "," : "", ((const uint32_t*)data)[i] & 0xFFFFFF);
+		}
+		fprintf(output, "]}\n");
+		break;
+
+		case HostEventFlash:
+		fprintf(output, ",\"op\":\"%s\",\"offset\":%u,\"bytes\":%u}\n", data ? "program" : "erase", arg, len);
+		break;
+
+		default:
+		fprintf(output, ",\"bytes\":");
+		printHex(data, len);
+		fprintf(output, "}\n");
+		break;
+	}
+}
+
+// The first output after an input gives that input's latency
+static void recordOutput(HostEventType type)
+{
+	outputCounts[type]++;
+	if(lastInput >= 0 && !lastInputAnswered)
+	{
+		lastInputAnswered = true;
+		latency[lastInput].latencies.push_back(host_Now() - lastInputTime);
+	}
+}
+
+// A blank device configures itself and requests a reset, the second init is the normal boot
+static void bootDevice()
+{
+	host_ClearResetRequest();
+	picoMod_Init();
+	if(host_ResetRequested())
+	{
+		host_ClearResetRequest();
+		picoMod_Init();
+	}
+}
+
+static const char* pinName(uint32_t pin)
+{
+	switch(pin)
+	{
+		case BYPASS_RELAY_PIN:
+		return "bypassRelay";
+
+		case AUX_RELAY_PIN:
+		return "auxRelay";
+
+		case SWITCH_OUT_PIN:
+		return "switchOut";
+
+		case DIGIPOT_CS:
+		return "digipotCs";
+	}
+	return "gpio";
+}
+
+static void printHex(const uint8_t* data, uint32_t len)
+{
+	fputc('"', output);
+	for(uint32_t i=0; i<len; i++)
+	{
+		fprintf(output, "%s%02x", i ? " " : "", data[i]);
+	}
+	fputc('"', output);
+}
+
+static void printString(const std::string& text)
+{
+	fputc('"', output);
+	for(char c : text)
+	{
+		if(c == '"' || c == '\\')
+		{
+			fprintf(output, "\\%c", c);
+		}
+		else if((uint8_t)c < 0x20)
+		{
+			fprintf(output, "\\u%04x", (uint8_t)c);
+		}
+		else
+		{
+			fputc(c, output);
+		}
+	}
+	fputc('"', output);
+}
+
+static void printSummary(uint64_t traceUs)
+{
+	uint64_t simulated = host_Now();
+	fprintf(output, "{\"summary\":{\"simulatedUs\":%llu,\"outputs\":{", (unsigned long long)simulated);
+	for(uint8_t i=0; i<NUM_HOST_EVENTS; i++)
+	{
+		fprintf(output, "%s\"%s\":%u", i ? "," : "", outputNames[i], outputCounts[i]);
+	}
+	fprintf(output, "},\"latencyUs\":{");
+	bool first = true;
+	for(uint8_t i=0; i<NUM_SIM_INPUTS; i++)
+	{
+		std::vector<uint64_t>& samples = latency[i].latencies;
+		if(latency[i].count == 0)
+		{
+			continue;
+		}
+		fprintf(output, "%s\"%s\":{\"inputs\":%u,\"answered\":%zu", first ? "" : ",", inputNames[i], latency[i].count, samples.size());
+		first = false;
+		if(!samples.empty())
+		{
+			std::sort(samples.begin(), samples.end());
+			fprintf(output, ",\"min\":%llu,\"median\":%llu,\"p99\":%llu,\"max\":%llu",
+					(unsigned long long)samples.front(),
+					(unsigned long long)samples[samples.size() / 2],
+					(unsigned long long)samples[(samples.size() * 99) / 100],
+					(unsigned long long)samples.back());
+		}
+		fprintf(output, "}");
+	}
+	const StorageStats* flash = storage_GetStats();
+	fprintf(output, "},\"flash\":{\"erases\":%u,\"pagePrograms\":%u,\"bytesProgrammed\":%u,\"blockedUs\":%llu,\"maxTypicalStallUs\":%u,\"maxWorstCaseStallUs\":%u",
+			flash->erases, flash->pagePrograms, flash->bytesProgrammed, (unsigned long long)flash->blockedUs, flash->maxBlockedUs, flash->maxWorstCaseUs);
+	if(flash->hottestErases)
+	{
+		double repeats = (double)STORAGE_ENDURANCE_CYCLES / flash->hottestErases;
+		fprintf(output, ",\"hottestSector\":%u,\"hottestErases\":%u,\"lifetimeRepeats\":%.0f,\"lifetimeHours\":%.1f",
+				flash->hottestSector, flash->hottestErases, repeats, repeats * traceUs / 3600e6);
+	}
+	fprintf(output, "}}}\n");
+}
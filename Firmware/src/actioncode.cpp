@@ -0,0 +1,357 @@
+#include "actioncode.h"
+#include "outputseq.h"
+
+using namespace MIDI_NAMESPACE;
+
+static_assert(NUM_ACTION_OPS <= 256, "Opcodes are one byte");
+
+// Private Function Prototypes
+static uint8_t compileAction(const Action* action, uint8_t* code);
+static uint8_t compileEvent(const Action* action, uint8_t* code);
+static bool isTwoByteMessage(MidiType type);
+static bool conditionHolds(uint8_t condition, uint8_t operand, uint8_t value);
+static uint8_t applyValue(uint8_t valueOp, uint8_t value, uint8_t operand);
+static void sendMidi(uint8_t destination, MidiType type, uint8_t data1, uint8_t data2, uint8_t channel);
+
+
+//------------------ System ------------------//
+// Lays out the code of each trigger's actions back to back, in action order, each
+// trigger's code ending with OpEnd. Actions that cannot do anything are left out
+void actionCode_Compile(const Preset* preset, ActionProgram* program)
+{
+	uint8_t numActions = preset->numActions < NUM_SWITCH_ACTIONS ? preset->numActions : NUM_SWITCH_ACTIONS;
+	uint16_t length = 0;
+	for(uint8_t trigger=0; trigger<NUM_TRIGGER_TYPES; trigger++)
+	{
+		program->entry[trigger] = length;
+		for(uint8_t i=0; i<numActions && trigger != TriggerNone; i++)
+		{
+			if(preset->actions[i].trigger.type == trigger)
+			{
+				length += compileAction(&preset->actions[i], &program->code[length]);
+			}
+		}
+		program->code[length++] = OpEnd;
+	}
+	program->length = length;
+}
+
+// number is the button event for switch triggers and the controller for CC triggers.
+// value is the triggering value that conditions and value operations work on
+void actionCode_Run(const ActionProgram* program, TriggerType triggerType, uint8_t number, uint8_t value)
+{
+	if(triggerType >= NUM_TRIGGER_TYPES)
+	{
+		return;
+	}
+	const uint8_t* pc = &program->code[program->entry[triggerType]];
+	uint8_t result = value;
+	while(true)
+	{
+		TRACE_BEGIN(opStart);
+		switch(*pc++)
+		{
+			case OpMatch:
+			pc += 2 + (number == pc[0] ? 0 : pc[1]);
+			break;
+
+			case OpIf:
+			pc += 3 + (conditionHolds(pc[0], pc[1], value) ? 0 : pc[2]);
+			break;
+
+			case OpValue:
+			result = applyValue(pc[0], value, pc[1]);
+			pc += 2;
+			break;
+
+			case OpMidi:
+			sendMidi(pc[0], (MidiType)pc[1], pc[3], pc[4], pc[2]);
+			pc += 5;
+			TRACE_END(TracePathActionMidi, opStart);
+			break;
+
+			case OpMidiValue1:
+			sendMidi(pc[0], (MidiType)pc[1], result, 0, pc[2]);
+			pc += 3;
+			TRACE_END(TracePathActionMidi, opStart);
+			break;
+
+			case OpMidiValue2:
+			sendMidi(pc[0], (MidiType)pc[1], pc[3], result, pc[2]);
+			pc += 4;
+			TRACE_END(TracePathActionMidi, opStart);
+			break;
+
+			case OpExp:
+			outputSeq_SetDigipot(pc[0] | (pc[1] << 8));
+			pc += 2;
+			TRACE_END(TracePathActionExp, opStart);
+			break;
+
+			case OpExpValue:
+			outputSeq_SetDigipot((result * 256) / 127);
+			TRACE_END(TracePathActionExp, opStart);
+			break;
+
+			case OpBypassOn:
+			relayBypassOn();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpBypassOff:
+			relayBypassOff();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpBypassToggle:
+			relayBypassToggle();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpAuxOn:
+			relayAuxOn();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpAuxOff:
+			relayAuxOff();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpAuxToggle:
+			relayAuxToggle();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpAnalogSwitchOn:
+			analogSwitchOn();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpAnalogSwitchOff:
+			analogSwitchOff();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpAnalogSwitchToggle:
+			analogSwitchToggle();
+			TRACE_END(TracePathActionOutput, opStart);
+			break;
+
+			case OpLed:
+			leds.setPixelColor(pc[0], ((uint32_t)pc[1] << 16) | (pc[2] << 8) | pc[3]);
+			leds.show();
+			pc += 4;
+			TRACE_END(TracePathActionLed, opStart);
+			break;
+
+			// OpEnd, or anything the compiler never emits
+			default:
+			return;
+		}
+	}
+}
+
+
+//-------------------- Local Functions --------------------//
+// Emits the match and condition checks, then the event.
+// Each check's skip operand is the number of bytes left in the action after it
+static uint8_t compileAction(const Action* action, uint8_t* code)
+{
+	uint8_t len = 0;
+	uint8_t skips[2];
+	uint8_t numSkips = 0;
+
+	TriggerType trigger = action->trigger.type;
+	// A button event of none fires on every event, as it always has
+	if(trigger <= TriggerGpio7 && action->trigger.value.buttonTrigger != ButtonNoEvent)
+	{
+		code[len++] = OpMatch;
+		code[len++] = action->trigger.value.buttonTrigger;
+		skips[numSkips++] = len++;
+	}
+	else if(trigger == TriggerCC)
+	{
+		code[len++] = OpMatch;
+		code[len++] = action->trigger.value.midiTrigger.midiNum;
+		skips[numSkips++] = len++;
+	}
+	if(action->condition != ConditionAlways && action->condition < NUM_ACTION_CONDITIONS)
+	{
+		code[len++] = OpIf;
+		code[len++] = action->condition;
+		code[len++] = action->conditionValue;
+		skips[numSkips++] = len++;
+	}
+
+	uint8_t eventLen = compileEvent(action, &code[len]);
+	if(eventLen == 0)
+	{
+		return 0;
+	}
+	len += eventLen;
+	for(uint8_t i=0; i<numSkips; i++)
+	{
+		code[skips[i]] = len - (skips[i] + 1);
+	}
+	return len;
+}
+
+static uint8_t compileEvent(const Action* action, uint8_t* code)
+{
+	uint8_t len = 0;
+	bool derived = action->valueOp != ValueFixed && action->valueOp < NUM_ACTION_VALUE_OPS;
+	switch(action->type)
+	{
+		case ActionEventMidi:
+		{
+			const MidiMessage* message = &action->event.midiMessage;
+			// Actions saved before destinations existed have the field cleared
+			uint8_t destination = message->destination ? message->destination : (uint8_t)MidiDestTrs;
+			bool twoByte = isTwoByteMessage(message->type);
+			if(derived)
+			{
+				code[len++] = OpValue;
+				code[len++] = action->valueOp;
+				code[len++] = twoByte ? message->data1 : message->data2;
+				code[len++] = twoByte ? OpMidiValue1 : OpMidiValue2;
+			}
+			else
+			{
+				code[len++] = OpMidi;
+			}
+			code[len++] = destination;
+			code[len++] = message->type;
+			code[len++] = message->channel;
+			if(!derived)
+			{
+				code[len++] = message->data1;
+				code[len++] = message->data2;
+			}
+			else if(!twoByte)
+			{
+				code[len++] = message->data1;
+			}
+			break;
+		}
+
+		case ActionEventExp:
+		if(derived)
+		{
+			code[len++] = OpValue;
+			code[len++] = action->valueOp;
+			code[len++] = (action->event.expMessage.value * 127) / 256;
+			code[len++] = OpExpValue;
+		}
+		else
+		{
+			code[len++] = OpExp;
+			code[len++] = action->event.expMessage.value & 0xFF;
+			code[len++] = action->event.expMessage.value >> 8;
+		}
+		break;
+
+		// On, off and toggle opcodes follow the OutputValue order for each target
+		case ActionEventOutput:
+		if(action->event.outputMessage.target <= OutputAnalogSwitch && action->event.outputMessage.value <= OutputToggle)
+		{
+			code[len++] = OpBypassOn + action->event.outputMessage.target * 3 + action->event.outputMessage.value;
+		}
+		break;
+
+		case ActionEventLed:
+		if(action->event.ledMessage.index < NUM_LEDS)
+		{
+			code[len++] = OpLed;
+			code[len++] = action->event.ledMessage.index;
+			code[len++] = action->event.ledMessage.colour >> 16;
+			code[len++] = action->event.ledMessage.colour >> 8;
+			code[len++] = action->event.ledMessage.colour;
+		}
+		break;
+	}
+	return len;
+}
+
+static bool isTwoByteMessage(MidiType type)
+{
+	return type == ProgramChange || type == AfterTouchChannel || type == SongSelect || type == TimeCodeQuarterFrame;
+}
+
+static bool conditionHolds(uint8_t condition, uint8_t operand, uint8_t value)
+{
+	switch(condition)
+	{
+		case ConditionBypassOn:
+		return presetState.bypassRelayState;
+
+		case ConditionBypassOff:
+		return !presetState.bypassRelayState;
+
+		case ConditionAuxOn:
+		return presetState.auxRelayState;
+
+		case ConditionAuxOff:
+		return !presetState.auxRelayState;
+
+		case ConditionAnalogSwitchOn:
+		return presetState.analogSwitchState;
+
+		case ConditionAnalogSwitchOff:
+		return !presetState.analogSwitchState;
+
+		case ConditionValueAbove:
+		return value > operand;
+
+		case ConditionValueBelow:
+		return value < operand;
+
+		case ConditionValueEquals:
+		return value == operand;
+	}
+	return true;
+}
+
+static uint8_t applyValue(uint8_t valueOp, uint8_t value, uint8_t operand)
+{
+	int16_t result;
+	switch(valueOp)
+	{
+		case ValuePassthrough:
+		result = value;
+		break;
+
+		case ValueAdd:
+		result = value + operand;
+		break;
+
+		case ValueSubtract:
+		result = value - operand;
+		break;
+
+		case ValueInvert:
+		result = 127 - value;
+		break;
+
+		case ValueScale:
+		result = (value * operand) / 127;
+		break;
+
+		default:
+		result = operand;
+		break;
+	}
+	return result < 0 ? 0 : result > 127 ? 127 : result;
+}
+
+static void sendMidi(uint8_t destination, MidiType type, uint8_t data1, uint8_t data2, uint8_t channel)
+{
+	if(destination & MidiDestTrs)
+	{
+		midiOut_Send(MidiPortTrs, type, data1, data2, channel);
+	}
+	if(destination & MidiDestUsb)
+	{
+		midiOut_Send(MidiPortUsb, type, data1, data2, channel);
+	}
+}
@@ -0,0 +1,239 @@
+#include "actionpool.h"
+
+static_assert(ACTION_POOL_SIZE < ACTION_BLOCK_NONE, "Block indexes must not collide with the unused marker");
+static_assert(NUM_PRESETS * NUM_SWITCH_ACTIONS <= UINT16_MAX, "Reference counts are 16 bit");
+
+// Indexed by block. A block with no references is free
+static uint16_t refCounts[ACTION_POOL_SIZE];
+static uint32_t blockHashes[ACTION_POOL_SIZE];
+static ActionPoolStats stats;
+
+// Private Function Prototypes
+static uint16_t internAction(const Action* action);
+static bool blockMatches(uint16_t block, const Action* action);
+static uint16_t releaseBlocks(const uint16_t* blocks, uint8_t count);
+
+
+//------------------ System ------------------//
+// Counts the references held by the stored presets. Indexes outside the pool are ignored
+void actionPool_Init()
+{
+	memset(refCounts, 0, sizeof(refCounts));
+	memset(&stats, 0, sizeof(stats));
+	PresetRecord record;
+	for(uint8_t i=0; i<NUM_PRESETS; i++)
+	{
+		actionPool_ReadRecord(i, &record);
+		for(uint8_t j=0; j<record.numActions; j++)
+		{
+			if(record.actions[j] < ACTION_POOL_SIZE)
+			{
+				refCounts[record.actions[j]]++;
+			}
+		}
+	}
+	Action action;
+	for(uint16_t block=0; block<ACTION_POOL_SIZE; block++)
+	{
+		if(refCounts[block])
+		{
+			storage_Read(StorageRecordAction, block, &action, sizeof(Action));
+			blockHashes[block] = storage_Hash(&action, sizeof(Action));
+		}
+	}
+}
+
+bool actionPool_ReadRecord(uint8_t index, PresetRecord* record)
+{
+	if(!storage_Read(StorageRecordPreset, index, record, sizeof(PresetRecord)))
+	{
+		return false;
+	}
+	if(record->numActions > NUM_SWITCH_ACTIONS)
+	{
+		record->numActions = NUM_SWITCH_ACTIONS;
+	}
+	return true;
+}
+
+// Resolves the record's blocks into a full preset. Unused slots are cleared to TriggerNone
+void actionPool_LoadPreset(uint8_t index, Preset* preset)
+{
+	memset(preset, 0, sizeof(Preset));
+	for(uint8_t j=0; j<NUM_SWITCH_ACTIONS; j++)
+	{
+		preset->actions[j].trigger.type = TriggerNone;
+	}
+	PresetRecord record;
+	if(!actionPool_ReadRecord(index, &record))
+	{
+		return;
+	}
+	preset->id = record.id;
+	preset->numActions = record.numActions;
+	preset->expValue = record.expValue;
+	preset->switch1State = record.switch1State;
+	preset->switch2State = record.switch2State;
+	preset->analogSwitchState = record.analogSwitchState;
+	preset->bypassRelayState = record.bypassRelayState;
+	preset->auxRelayState = record.auxRelayState;
+	for(uint8_t j=0; j<record.numActions; j++)
+	{
+		if(record.actions[j] < ACTION_POOL_SIZE)
+		{
+			storage_Read(StorageRecordAction, record.actions[j], &preset->actions[j], sizeof(Action));
+		}
+	}
+}
+
+// New references are taken before the old ones are dropped, so a block freed by this
+// save is never rewritten by it and the previous record stays intact until the commit.
+// Fails without writing the record when the pool has no room for the new actions
+bool actionPool_StorePreset(uint8_t index, const Preset* preset)
+{
+	PresetRecord previous;
+	if(!actionPool_ReadRecord(index, &previous))
+	{
+		return false;
+	}
+
+	PresetRecord record;
+	memset(&record, 0, sizeof(PresetRecord));
+	record.id = preset->id;
+	record.numActions = preset->numActions < NUM_SWITCH_ACTIONS ? preset->numActions : NUM_SWITCH_ACTIONS;
+	record.expValue = preset->expValue;
+	record.switch1State = preset->switch1State;
+	record.switch2State = preset->switch2State;
+	record.analogSwitchState = preset->analogSwitchState;
+	record.bypassRelayState = preset->bypassRelayState;
+	record.auxRelayState = preset->auxRelayState;
+	for(uint8_t j=0; j<NUM_SWITCH_ACTIONS; j++)
+	{
+		record.actions[j] = ACTION_BLOCK_NONE;
+	}
+	for(uint8_t j=0; j<record.numActions; j++)
+	{
+		record.actions[j] = internAction(&preset->actions[j]);
+		if(record.actions[j] == ACTION_BLOCK_NONE)
+		{
+			releaseBlocks(record.actions, j);
+			stats.poolFull++;
+			return false;
+		}
+	}
+
+	storage_Write(StorageRecordPreset, index, &record, sizeof(PresetRecord));
+	stats.reclaimed += releaseBlocks(previous.actions, previous.numActions);
+	storage_Commit();
+	return true;
+}
+
+// Rewrites a block in place, changing it in every preset that references it
+bool actionPool_WriteBlock(uint16_t block, const Action* action)
+{
+	if(block >= ACTION_POOL_SIZE || refCounts[block] == 0)
+	{
+		return false;
+	}
+	storage_Write(StorageRecordAction, block, action, sizeof(Action));
+	storage_Commit();
+	blockHashes[block] = storage_Hash(action, sizeof(Action));
+	return true;
+}
+
+// Covers the preset's content only, never the block indexes, so it does not depend on
+// how the pool is laid out and the editor can compute it from its own copy of the
+// preset (docs/actions.txt). An edit to a shared block changes each preset using it
+uint32_t actionPool_PresetHash(uint8_t index)
+{
+	PresetRecord record;
+	if(!actionPool_ReadRecord(index, &record))
+	{
+		return 0;
+	}
+	uint32_t hash = storage_Hash(&record.id, sizeof(record.id));
+	hash = storage_Hash(&record.numActions, sizeof(record.numActions), hash);
+	hash = storage_Hash(&record.expValue, sizeof(record.expValue), hash);
+	hash = storage_Hash(&record.switch1State, sizeof(record.switch1State), hash);
+	hash = storage_Hash(&record.switch2State, sizeof(record.switch2State), hash);
+	hash = storage_Hash(&record.analogSwitchState, sizeof(record.analogSwitchState), hash);
+	hash = storage_Hash(&record.bypassRelayState, sizeof(record.bypassRelayState), hash);
+	hash = storage_Hash(&record.auxRelayState, sizeof(record.auxRelayState), hash);
+	for(uint8_t j=0; j<record.numActions; j++)
+	{
+		if(record.actions[j] < ACTION_POOL_SIZE)
+		{
+			hash = storage_Hash(&blockHashes[record.actions[j]], sizeof(uint32_t), hash);
+		}
+	}
+	return hash;
+}
+
+const ActionPoolStats* actionPool_GetStats()
+{
+	stats.used = 0;
+	stats.shared = 0;
+	stats.references = 0;
+	for(uint16_t block=0; block<ACTION_POOL_SIZE; block++)
+	{
+		stats.used += refCounts[block] > 0;
+		stats.shared += refCounts[block] > 1;
+		stats.references += refCounts[block];
+	}
+	return &stats;
+}
+
+
+//-------------------- Local Functions --------------------//
+// Takes a reference to a block holding this action, writing it to the first free
+// block if there is none. Returns ACTION_BLOCK_NONE when the pool is full
+static uint16_t internAction(const Action* action)
+{
+	uint32_t hash = storage_Hash(action, sizeof(Action));
+	uint16_t freeBlock = ACTION_BLOCK_NONE;
+	for(uint16_t block=0; block<ACTION_POOL_SIZE; block++)
+	{
+		if(refCounts[block] == 0)
+		{
+			if(freeBlock == ACTION_BLOCK_NONE)
+			{
+				freeBlock = block;
+			}
+		}
+		else if(blockHashes[block] == hash && blockMatches(block, action))
+		{
+			refCounts[block]++;
+			return block;
+		}
+	}
+	if(freeBlock != ACTION_BLOCK_NONE)
+	{
+		storage_Write(StorageRecordAction, freeBlock, action, sizeof(Action));
+		blockHashes[freeBlock] = hash;
+		refCounts[freeBlock] = 1;
+	}
+	return freeBlock;
+}
+
+// Hashes can collide, the stored block is compared before it is shared
+static bool blockMatches(uint16_t block, const Action* action)
+{
+	Action stored;
+	storage_Read(StorageRecordAction, block, &stored, sizeof(Action));
+	return memcmp(&stored, action, sizeof(Action)) == 0;
+}
+
+// Returns the number of blocks left without references
+static uint16_t releaseBlocks(const uint16_t* blocks, uint8_t count)
+{
+	uint16_t freed = 0;
+	for(uint8_t j=0; j<count; j++)
+	{
+		if(blocks[j] < ACTION_POOL_SIZE && refCounts[blocks[j]] > 0)
+		{
+			refCounts[blocks[j]]--;
+			freed += refCounts[blocks[j]] == 0;
+		}
+	}
+	return freed;
+}
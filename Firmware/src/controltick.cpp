@@ -0,0 +1,64 @@
+#include "controltick.h"
+#include "pico/time.h"
+
+static uint64_t deadline;				// Start of the next tick
+static uint64_t tickStart;
+static ControlTickStats stats;
+
+
+//------------------ System ------------------//
+void controlTick_Init()
+{
+	memset(&stats, 0, sizeof(ControlTickStats));
+	deadline = time_us_64() + CONTROL_TICK_US;
+}
+
+// True when a tick is due. The tick work is followed by controlTick_Done()
+bool controlTick_Due()
+{
+	uint64_t now = time_us_64();
+	if(now < deadline)
+	{
+		return false;
+	}
+	uint64_t late = now - deadline;
+	uint64_t missed = late / CONTROL_TICK_US;
+	stats.overruns += missed;
+	deadline += (missed + 1) * CONTROL_TICK_US;
+	if(late > stats.maxLateUs)
+	{
+		stats.maxLateUs = late;
+	}
+	tickStart = now;
+	return true;
+}
+
+void controlTick_Done()
+{
+	uint32_t length = time_us_64() - tickStart;
+	if(length > stats.maxTickUs)
+	{
+		stats.maxTickUs = length;
+	}
+	stats.ticks++;
+}
+
+// Waits for an interrupt, returning no later than the next tick.
+// An interrupt taken after the caller last checked for work leaves the event
+// register set, so the wait ends at once rather than missing it
+void controlTick_Sleep()
+{
+	uint64_t start = time_us_64();
+	if(start >= deadline)
+	{
+		return;
+	}
+	best_effort_wfe_or_timeout(from_us_since_boot(deadline));
+	stats.sleeps++;
+	stats.sleptUs += time_us_64() - start;
+}
+
+const ControlTickStats* controlTick_GetStats()
+{
+	return &stats;
+}
@@ -0,0 +1,295 @@
+#include "picomod.h"
+#include "expinput.h"
+#include "outputseq.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+
+typedef struct
+{
+	int32_t filtered;			// Oversampled and filtered reading (EXP_OVERSAMPLE * 12-bit)
+	uint16_t position;		// Last accepted 14-bit position after hysteresis
+	uint16_t sentValue;		// Last value emitted to the output
+	bool pending;				// A new value is waiting on the rate limit
+	uint32_t lastSendMs;
+} ExpInputState;
+
+// Sample ring written by DMA. Must be aligned to its own size for the DMA ring wrap
+static volatile uint16_t sampleRing[EXP_RING_SAMPLES] __attribute__((aligned(1 << EXP_RING_BITS)));
+
+// Two channels chained to each other so sampling never stops and needs no IRQ
+static int dmaChannels[2] = {-1, -1};
+static bool samplingActive = false;
+static bool calibrating = false;
+
+static ExpInputState states[NUM_EXP_INPUTS];
+static const uint8_t expPins[NUM_EXP_INPUTS] = {EXP1_PIN, EXP2_PIN, EXP3_PIN};
+
+// Private Function Prototypes
+static void startSampling();
+static void stopSampling();
+static uint16_t calculatePosition(ExpInputConfig* config, int32_t filtered);
+static uint16_t scalePosition(ExpInputMode mode, uint16_t position);
+static void sendValue(uint8_t index, ExpInputConfig* config, uint16_t value);
+
+
+//------------------ System ------------------//
+void expInput_Init()
+{
+	stopSampling();
+
+	bool anyEnabled = false;
+	for(uint8_t i=0; i<NUM_EXP_INPUTS; i++)
+	{
+		states[i].filtered = -1;
+		states[i].position = 0;
+		states[i].sentValue = 0xFFFF;
+		states[i].pending = false;
+		states[i].lastSendMs = 0;
+		if(globalConfig.expInputs[i].mode != ExpInputOff)
+		{
+			adc_gpio_init(expPins[i]);
+			anyEnabled = true;
+		}
+	}
+
+	if(anyEnabled)
+	{
+		startSampling();
+	}
+}
+
+// Run from the control tick. The ring only holds a few ms of samples,
+// there is no benefit reducing it more often
+void expInput_Process()
+{
+	if(!samplingActive)
+	{
+		return;
+	}
+	// Oversample by summing the whole ring. Samples are interleaved by channel,
+	// so slot i always belongs to channel i % EXP_ADC_CHANNELS
+	uint32_t sums[EXP_ADC_CHANNELS] = {0};
+	for(uint32_t i=0; i<EXP_RING_SAMPLES; i++)
+	{
+		sums[i % EXP_ADC_CHANNELS] += sampleRing[i] & EXP_ADC_MAX;
+	}
+
+	uint32_t nowMs = millis();
+	for(uint8_t i=0; i<NUM_EXP_INPUTS; i++)
+	{
+		ExpInputConfig* config = &globalConfig.expInputs[i];
+		ExpInputState* state = &states[i];
+		if(config->mode == ExpInputOff)
+		{
+			continue;
+		}
+
+		// Filter
+		int32_t sum = (int32_t)sums[i];
+		if(state->filtered < 0)
+		{
+			state->filtered = sum;
+		}
+		else
+		{
+			state->filtered += (sum - state->filtered) >> EXP_FILTER_SHIFT;
+		}
+
+		// Calibration capture follows the extremes while the user sweeps the pedal
+		if(calibrating)
+		{
+			uint16_t reading = state->filtered / EXP_OVERSAMPLE;
+			if(reading < config->calMin)
+			{
+				config->calMin = reading;
+			}
+			if(reading > config->calMax)
+			{
+				config->calMax = reading;
+			}
+			continue;
+		}
+
+		// Hysteresis. The position must move a fraction of an output step past the last
+		// accepted position, otherwise noise at a step boundary would toggle the output
+		uint16_t position = calculatePosition(config, state->filtered);
+		int32_t delta = (int32_t)position - (int32_t)state->position;
+		if(delta < 0)
+		{
+			delta = -delta;
+		}
+		if(delta >= EXP_HYSTERESIS || position == 0 || position == EXP_POSITION_MAX)
+		{
+			state->position = position;
+		}
+
+		uint16_t value = scalePosition(config->mode, state->position);
+		if(value != state->sentValue)
+		{
+			state->pending = true;
+		}
+
+		// Rate limit. Only the freshest value is sent once the interval has elapsed
+		if(state->pending && (nowMs - state->lastSendMs) >= EXP_MIN_SEND_INTERVAL_MS)
+		{
+			sendValue(i, config, value);
+			state->sentValue = value;
+			state->lastSendMs = nowMs;
+			state->pending = false;
+		}
+	}
+}
+
+// Resets the calibration range so the next sweep captures the full travel
+void expInput_StartCalibration()
+{
+	for(uint8_t i=0; i<NUM_EXP_INPUTS; i++)
+	{
+		globalConfig.expInputs[i].calMin = EXP_ADC_MAX;
+		globalConfig.expInputs[i].calMax = 0;
+	}
+	calibrating = true;
+}
+
+void expInput_EndCalibration()
+{
+	calibrating = false;
+	for(uint8_t i=0; i<NUM_EXP_INPUTS; i++)
+	{
+		// An input that was not swept keeps the full ADC range
+		if(globalConfig.expInputs[i].calMax <= globalConfig.expInputs[i].calMin)
+		{
+			globalConfig.expInputs[i].calMin = 0;
+			globalConfig.expInputs[i].calMax = EXP_ADC_MAX;
+		}
+		states[i].sentValue = 0xFFFF;
+	}
+}
+
+bool expInput_IsCalibrating()
+{
+	return calibrating;
+}
+
+uint16_t expInput_GetPosition(uint8_t index)
+{
+	if(index >= NUM_EXP_INPUTS)
+	{
+		return 0;
+	}
+	return states[index].position;
+}
+
+
+//-------------------- Local Functions --------------------//
+static void startSampling()
+{
+	adc_init();
+	adc_set_round_robin((1 << EXP_ADC_CHANNELS) - 1);
+	adc_select_input(0);
+	// FIFO enabled with DREQ on every sample. No shift, DMA moves the full 12-bit result
+	adc_fifo_setup(true, true, 1, false, false);
+	// ADC clock is 48MHz, clkdiv sets the interval between conversions in clock cycles
+	adc_set_clkdiv(48000000.0f / EXP_SAMPLE_RATE - 1);
+	adc_fifo_drain();
+
+	dmaChannels[0] = dma_claim_unused_channel(true);
+	dmaChannels[1] = dma_claim_unused_channel(true);
+	for(uint8_t i=0; i<2; i++)
+	{
+		dma_channel_config config = dma_channel_get_default_config(dmaChannels[i]);
+		channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+		channel_config_set_read_increment(&config, false);
+		channel_config_set_write_increment(&config, true);
+		channel_config_set_ring(&config, true, EXP_RING_BITS);
+		channel_config_set_dreq(&config, DREQ_ADC);
+		channel_config_set_chain_to(&config, dmaChannels[i ^ 1]);
+		// Each channel fills the ring exactly once, finishing back at the ring start
+		dma_channel_configure(dmaChannels[i], &config, sampleRing, &adc_hw->fifo, EXP_RING_SAMPLES, false);
+	}
+	dma_channel_start(dmaChannels[0]);
+	adc_run(true);
+	samplingActive = true;
+}
+
+static void stopSampling()
+{
+	if(!samplingActive)
+	{
+		return;
+	}
+	adc_run(false);
+	for(uint8_t i=0; i<2; i++)
+	{
+		dma_channel_abort(dmaChannels[i]);
+		dma_channel_unclaim(dmaChannels[i]);
+		dmaChannels[i] = -1;
+	}
+	adc_fifo_drain();
+	adc_set_round_robin(0);
+	samplingActive = false;
+}
+
+// Maps the filtered reading through the calibration range to a 14-bit position
+static uint16_t calculatePosition(ExpInputConfig* config, int32_t filtered)
+{
+	int32_t min = (int32_t)config->calMin * EXP_OVERSAMPLE;
+	int32_t max = (int32_t)config->calMax * EXP_OVERSAMPLE;
+	if(max <= min)
+	{
+		min = 0;
+		max = EXP_ADC_MAX * EXP_OVERSAMPLE;
+	}
+	if(filtered <= min)
+	{
+		return 0;
+	}
+	if(filtered >= max)
+	{
+		return EXP_POSITION_MAX;
+	}
+	return ((filtered - min) * EXP_POSITION_MAX) / (max - min);
+}
+
+static uint16_t scalePosition(ExpInputMode mode, uint16_t position)
+{
+	switch(mode)
+	{
+		case ExpInputCC:
+		return position >> 7;
+
+		case ExpInputCC14:
+		return position;
+
+		case ExpInputDigipot:
+		// Digipot has 257 steps (0-256)
+		return ((uint32_t)position * 256 + (EXP_POSITION_MAX / 2)) / EXP_POSITION_MAX;
+
+		default:
+		return 0;
+	}
+}
+
+static void sendValue(uint8_t index, ExpInputConfig* config, uint16_t value)
+{
+	switch(config->mode)
+	{
+		case ExpInputCC:
+		midiOut_Send(MidiPortTrs, MIDI_NAMESPACE::ControlChange, config->ccNumber, value, config->channel);
+		break;
+
+		case ExpInputCC14:
+		// MSB first so receivers reset their LSB, then the fine LSB on the paired controller
+		midiOut_Send(MidiPortTrs, MIDI_NAMESPACE::ControlChange, config->ccNumber, value >> 7, config->channel);
+		midiOut_Send(MidiPortTrs, MIDI_NAMESPACE::ControlChange, config->ccNumber + 32, value & 0x7F, config->channel);
+		break;
+
+		case ExpInputDigipot:
+		// Held back while a relay is moving, like the preset's own digipot changes
+		outputSeq_SetDigipot(value);
+		break;
+
+		default:
+		break;
+	}
+}
@@ -0,0 +1,122 @@
+#include "memstats.h"
+
+// Memory map symbols from the RP2040 linker script. The host build has no linker
+// script so host/src/hal.cpp describes an equivalent map instead
+#ifdef PICOMOD_HOST
+#include "host.h"
+#define MEM_SYMBOL(name)		host_MemorySymbol(#name)
+#else
+#include <malloc.h>
+extern "C" uint8_t __data_start__[], __data_end__[];
+extern "C" uint8_t __bss_start__[], __bss_end__[];
+extern "C" uint8_t __end__[], __StackLimit[];
+extern "C" uint8_t __StackBottom[], __StackTop[];
+extern "C" uint8_t __StackOneBottom[], __StackOneTop[];
+#define MEM_SYMBOL(name)		((uintptr_t)name)
+#endif
+
+typedef struct
+{
+	uintptr_t bottom;
+	uintptr_t top;
+} StackRegion;
+
+static StackRegion stackRegions[MEM_NUM_CORES];
+static uint32_t jsonArenaSize;
+static uint32_t jsonArenaPeak;
+static uint32_t jsonArenaOverflows;
+
+// Private Function Prototypes
+static void paintStack(StackRegion* region);
+
+
+//------------------ System ------------------//
+// Must be called as early as possible, anything already deeper than the current
+// frame is counted as used. Core 1 is not started by this firmware so its whole
+// stack is painted and should always report a high water of 0
+void memStats_Init()
+{
+	stackRegions[0].bottom = MEM_SYMBOL(__StackBottom);
+	stackRegions[0].top = MEM_SYMBOL(__StackTop);
+	stackRegions[1].bottom = MEM_SYMBOL(__StackOneBottom);
+	stackRegions[1].top = MEM_SYMBOL(__StackOneTop);
+
+	for(uint8_t i=0; i<MEM_NUM_CORES; i++)
+	{
+		paintStack(&stackRegions[i]);
+	}
+}
+
+// Scans up from the bottom of the stack for the first word that no longer holds the paint
+uint32_t memStats_StackHighWater(uint8_t core)
+{
+	if(core >= MEM_NUM_CORES)
+	{
+		return 0;
+	}
+	StackRegion* region = &stackRegions[core];
+	volatile uint32_t* word = (volatile uint32_t*)region->bottom;
+	volatile uint32_t* top = (volatile uint32_t*)region->top;
+	while(word < top && *word == MEM_STACK_PAINT)
+	{
+		word++;
+	}
+	return region->top - (uintptr_t)word;
+}
+
+// Called each time the shared JSON arena is released
+void memStats_RecordJsonArena(size_t capacity, size_t used, bool overflowed)
+{
+	jsonArenaSize = capacity;
+	if(used > jsonArenaPeak)
+	{
+		jsonArenaPeak = used;
+	}
+	if(overflowed)
+	{
+		jsonArenaOverflows++;
+	}
+}
+
+void memStats_Get(MemStats* stats)
+{
+	stats->dataSize = MEM_SYMBOL(__data_end__) - MEM_SYMBOL(__data_start__);
+	stats->bssSize = MEM_SYMBOL(__bss_end__) - MEM_SYMBOL(__bss_start__);
+	stats->heapSize = MEM_SYMBOL(__StackLimit) - MEM_SYMBOL(__end__);
+#ifdef PICOMOD_HOST
+	stats->heapArena = 0;
+	stats->heapUsed = 0;
+	stats->heapFree = 0;
+#else
+	struct mallinfo heap = mallinfo();
+	stats->heapArena = heap.arena;
+	stats->heapUsed = heap.uordblks;
+	stats->heapFree = heap.fordblks;
+#endif
+	for(uint8_t i=0; i<MEM_NUM_CORES; i++)
+	{
+		stats->stacks[i].size = stackRegions[i].top - stackRegions[i].bottom;
+		stats->stacks[i].highWater = memStats_StackHighWater(i);
+	}
+	stats->jsonArenaSize = jsonArenaSize;
+	stats->jsonArenaPeak = jsonArenaPeak;
+	stats->jsonArenaOverflows = jsonArenaOverflows;
+}
+
+
+//-------------------- Local Functions --------------------//
+// Paints from the bottom of the region up to just below the live stack pointer,
+// or the whole region if the caller is running on a different stack
+static void paintStack(StackRegion* region)
+{
+	uintptr_t limit = region->top;
+	uintptr_t frame = (uintptr_t)__builtin_frame_address(0);
+	if(frame > region->bottom && frame <= region->top)
+	{
+		limit = frame - MEM_STACK_PAINT_GUARD;
+	}
+	for(volatile uint32_t* word = (volatile uint32_t*)region->bottom; (uintptr_t)word < limit; word++)
+	{
+		*word = MEM_STACK_PAINT;
+	}
+}
@@ -0,0 +1,577 @@
+#include "picomod.h"
+#include "midiout.h"
+#include "hardware/dma.h"
+
+using namespace MIDI_NAMESPACE;
+
+static MidiOutQueue queues[NUM_MIDI_PORTS];
+
+// TRS bytes are moved from this buffer to the UART by DMA, paced by the UART DREQ
+static uint8_t trsDmaBuffer[MIDI_OUT_DMA_BATCH];
+static int trsDmaChannel = -1;
+
+// One USB SysEx stream at a time, packed three bytes per event packet
+typedef struct
+{
+	uint8_t buffer[MIDI_OUT_SYSEX_BUFFER_SIZE];
+	uint16_t head;
+	uint16_t count;
+	uint8_t cable;
+	bool active;			// Start sent but not the end, the cable carries only realtime meanwhile
+} UsbSysEx;
+
+static UsbSysEx usbSysEx;
+
+// Private Function Prototypes
+static uint8_t messageLength(uint8_t status);
+static bool isCoalescable(uint8_t status);
+static bool isPriority(uint8_t status);
+static bool isBankSelect(const MidiOutMessage* message);
+static bool bankChangeQueued(MidiOutQueue* q, const MidiOutMessage* message);
+static bool coalesce(MidiOutQueue* q, MidiOutMessage* message);
+static MidiOutMessage* peekMessage(MidiOutQueue* q);
+static void popMessage(MidiOutQueue* q);
+static uint8_t serialiseMessage(MidiOutQueue* q, MidiOutMessage* message, uint8_t* buffer);
+static bool queueMessage(MidiPort port, uint8_t cable, MidiType type, uint8_t data1, uint8_t data2, uint8_t channel);
+static uint16_t usbPendingPackets(MidiOutQueue* q);
+static void buildUsbPacket(MidiOutMessage* message, uint8_t* packet);
+static uint8_t buildSysExPacket(uint8_t* packet);
+static void popSysEx(uint8_t length, bool end);
+static void drainTrs(MidiOutQueue* q);
+static void drainUsb(MidiOutQueue* q, bool flush);
+
+
+//------------------ System ------------------//
+void midiOut_Init()
+{
+	memset(queues, 0, sizeof(queues));
+	memset(&usbSysEx, 0, sizeof(usbSysEx));
+	// DIN receivers all support running status, USB MIDI packets always carry the status
+	queues[MidiPortTrs].useRunningStatus = true;
+
+	// TRS transmit DMA. Must run after Serial1.begin() as the UART init clears DMACR
+	if(trsDmaChannel < 0)
+	{
+		trsDmaChannel = dma_claim_unused_channel(true);
+	}
+	dma_channel_config config = dma_channel_get_default_config(trsDmaChannel);
+	channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+	channel_config_set_read_increment(&config, true);
+	channel_config_set_write_increment(&config, false);
+	channel_config_set_dreq(&config, uart_get_dreq(MIDI_OUT_TRS_UART, true));
+	dma_channel_configure(trsDmaChannel, &config, &uart_get_hw(MIDI_OUT_TRS_UART)->dr, trsDmaBuffer, 0, false);
+	uart_get_hw(MIDI_OUT_TRS_UART)->dmacr |= UART_UARTDMACR_TXDMAE_BITS;
+}
+
+// Queues a message for transmission. Never blocks.
+// Main loop only, the queues are not guarded against interrupts.
+// On USB realtime messages use the clock cable and everything else the local cable
+bool midiOut_Send(MidiPort port, MidiType type, uint8_t data1, uint8_t data2, uint8_t channel)
+{
+	uint8_t cable = 0;
+	if(port == MidiPortUsb)
+	{
+		cable = type >= Clock ? MidiCableClock : MidiCableLocal;
+	}
+	return queueMessage(port, cable, type, data1, data2, channel);
+}
+
+bool midiOut_SendUsb(MidiUsbCable cable, MidiType type, uint8_t data1, uint8_t data2, uint8_t channel)
+{
+	if(cable >= NUM_MIDI_USB_CABLES)
+	{
+		return false;
+	}
+	return queueMessage(MidiPortUsb, cable, type, data1, data2, channel);
+}
+
+// Appends SysEx bytes, including the start and end bytes, to the USB stream.
+// A dump may arrive in several parts, but only one cable streams at a time
+// and a part is only accepted if all of it fits
+bool midiOut_SendUsbSysEx(MidiUsbCable cable, const uint8_t* data, uint16_t length)
+{
+	MidiOutQueue* q = &queues[MidiPortUsb];
+	bool busy = usbSysEx.active || usbSysEx.count;
+	if(cable >= NUM_MIDI_USB_CABLES || (busy && usbSysEx.cable != cable)
+		|| length > MIDI_OUT_SYSEX_BUFFER_SIZE - usbSysEx.count)
+	{
+		q->stats.dropped++;
+		return false;
+	}
+	if(usbPendingPackets(q) == 0)
+	{
+		q->pendingSinceUs = micros();
+	}
+	usbSysEx.cable = cable;
+	for(uint16_t i=0; i<length; i++)
+	{
+		usbSysEx.buffer[(usbSysEx.head + usbSysEx.count) % MIDI_OUT_SYSEX_BUFFER_SIZE] = data[i];
+		usbSysEx.count++;
+	}
+	q->stats.queued++;
+	drainUsb(q, false);
+	return true;
+}
+
+// Moves as many queued bytes to the transports as they will accept without blocking
+void midiOut_Process()
+{
+	drainTrs(&queues[MidiPortTrs]);
+	drainUsb(&queues[MidiPortUsb], false);
+}
+
+// Releases everything waiting for USB without holding it back for a fuller transfer.
+// Called once a trigger has queued all of its actions so they leave together
+void midiOut_Flush()
+{
+	drainTrs(&queues[MidiPortTrs]);
+	drainUsb(&queues[MidiPortUsb], true);
+}
+
+bool midiOut_IsIdle()
+{
+	for(uint8_t i=0; i<NUM_MIDI_PORTS; i++)
+	{
+		if(queues[i].count || queues[i].priorityCount)
+		{
+			return false;
+		}
+	}
+	if(usbSysEx.count)
+	{
+		return false;
+	}
+	return !dma_channel_is_busy(trsDmaChannel);
+}
+
+const MidiOutStats* midiOut_GetStats(MidiPort port)
+{
+	if(port >= NUM_MIDI_PORTS)
+	{
+		return NULL;
+	}
+	return &queues[port].stats;
+}
+
+void midiOut_ResetStats()
+{
+	for(uint8_t i=0; i<NUM_MIDI_PORTS; i++)
+	{
+		memset(&queues[i].stats, 0, sizeof(MidiOutStats));
+	}
+}
+
+
+//-------------------- Local Functions --------------------//
+// Continuous controllers replace any queued value for the same controller,
+// program changes and realtime messages skip ahead of the normal queue. A program change
+// waits its turn behind a bank select queued for its channel, so the bank is set first.
+static bool queueMessage(MidiPort port, uint8_t cable, MidiType type, uint8_t data1, uint8_t data2, uint8_t channel)
+{
+	if(port >= NUM_MIDI_PORTS || type < NoteOff)
+	{
+		return false;
+	}
+	MidiOutQueue* q = &queues[port];
+	if(port == MidiPortUsb && usbPendingPackets(q) == 0)
+	{
+		q->pendingSinceUs = micros();
+	}
+
+
+	MidiOutMessage message;
+	message.cable = cable;
+	if(type < SystemExclusive)
+	{
+		// Channel voice messages use channels 1-16
+		if(channel == MIDI_CHANNEL_OMNI || channel >= MIDI_CHANNEL_OFF)
+		{
+			return false;
+		}
+		message.status = type | ((channel - 1) & 0x0F);
+	}
+	else
+	{
+		message.status = type;
+	}
+	message.data1 = data1 & 0x7F;
+	message.data2 = data2 & 0x7F;
+	message.length = messageLength(message.status);
+	if(message.length == 0)
+	{
+		return false;
+	}
+#ifdef PICOMOD_TRACE
+	message.originUs = trace_Origin();
+#endif
+
+	if(isPriority(message.status) && !bankChangeQueued(q, &message))
+	{
+		if(q->priorityCount >= MIDI_OUT_PRIORITY_QUEUE_SIZE)
+		{
+			q->stats.dropped++;
+			return false;
+		}
+		q->priorityQueue[(q->priorityHead + q->priorityCount) % MIDI_OUT_PRIORITY_QUEUE_SIZE] = message;
+		q->priorityCount++;
+	}
+	else if(isCoalescable(message.status) && coalesce(q, &message))
+	{
+		q->stats.coalesced++;
+	}
+	else
+	{
+		if(q->count >= MIDI_OUT_QUEUE_SIZE)
+		{
+			q->stats.dropped++;
+			return false;
+		}
+		q->queue[(q->head + q->count) % MIDI_OUT_QUEUE_SIZE] = message;
+		q->count++;
+		if(q->count > q->stats.highWater)
+		{
+			q->stats.highWater = q->count;
+		}
+	}
+	q->stats.queued++;
+
+	// Start the transmission straight away if the transport has room
+	midiOut_Process();
+	return true;
+}
+
+// Event packets waiting for USB, the SysEx stream is rounded up to whole packets
+static uint16_t usbPendingPackets(MidiOutQueue* q)
+{
+	return q->count + q->priorityCount + (usbSysEx.count + 2) / 3;
+}
+
+static uint8_t messageLength(uint8_t status)
+{
+	switch(status & 0xF0)
+	{
+		case NoteOff:
+		case NoteOn:
+		case AfterTouchPoly:
+		case ControlChange:
+		case PitchBend:
+		return 3;
+
+		case ProgramChange:
+		case AfterTouchChannel:
+		return 2;
+	}
+	switch(status)
+	{
+		case SongPosition:
+		return 3;
+
+		case TimeCodeQuarterFrame:
+		case SongSelect:
+		return 2;
+
+		case TuneRequest:
+		case Clock:
+		case Start:
+		case Continue:
+		case Stop:
+		case ActiveSensing:
+		case SystemReset:
+		return 1;
+	}
+	// SysEx and undefined messages are not queued
+	return 0;
+}
+
+// Only the latest value of a continuous controller matters
+static bool isCoalescable(uint8_t status)
+{
+	uint8_t type = status & 0xF0;
+	return type == ControlChange || type == PitchBend || type == AfterTouchChannel;
+}
+
+static bool isPriority(uint8_t status)
+{
+	return (status & 0xF0) == ProgramChange || status >= Clock;
+}
+
+// Bank select MSB and LSB, controllers 0 and 32
+static bool isBankSelect(const MidiOutMessage* message)
+{
+	return (message->status & 0xF0) == ControlChange && (message->data1 & ~32) == 0;
+}
+
+// True when a bank select or an earlier program change for the channel of a
+// program change is still in the normal queue
+static bool bankChangeQueued(MidiOutQueue* q, const MidiOutMessage* message)
+{
+	if((message->status & 0xF0) != ProgramChange)
+	{
+		return false;
+	}
+	uint8_t status = ControlChange | (message->status & 0x0F);
+	for(uint8_t i=0; i<q->count; i++)
+	{
+		MidiOutMessage* queued = &q->queue[(q->head + i) % MIDI_OUT_QUEUE_SIZE];
+		if(queued->cable == message->cable
+			&& (queued->status == message->status || (queued->status == status && isBankSelect(queued))))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Replaces the value of a queued message for the same controller.
+// The queued message keeps its place so ordering against other controllers is preserved.
+// A bank select is not moved ahead of a program change queued after it
+static bool coalesce(MidiOutQueue* q, MidiOutMessage* message)
+{
+	bool matchData1 = (message->status & 0xF0) == ControlChange;
+	uint8_t programChange = ProgramChange | (message->status & 0x0F);
+	for(uint8_t i=q->count; i>0; i--)
+	{
+		MidiOutMessage* queued = &q->queue[(q->head + i - 1) % MIDI_OUT_QUEUE_SIZE];
+		if(isBankSelect(message) && queued->status == programChange && queued->cable == message->cable)
+		{
+			return false;
+		}
+		if(queued->status == message->status && queued->cable == message->cable
+			&& (!matchData1 || queued->data1 == message->data1))
+		{
+			queued->data1 = message->data1;
+			queued->data2 = message->data2;
+			return true;
+		}
+	}
+	return false;
+}
+
+static MidiOutMessage* peekMessage(MidiOutQueue* q)
+{
+	if(q->priorityCount)
+	{
+		return &q->priorityQueue[q->priorityHead];
+	}
+	if(q->count)
+	{
+		return &q->queue[q->head];
+	}
+	return NULL;
+}
+
+static void popMessage(MidiOutQueue* q)
+{
+	if(q->priorityCount)
+	{
+		q->priorityHead = (q->priorityHead + 1) % MIDI_OUT_PRIORITY_QUEUE_SIZE;
+		q->priorityCount--;
+	}
+	else if(q->count)
+	{
+		q->head = (q->head + 1) % MIDI_OUT_QUEUE_SIZE;
+		q->count--;
+	}
+}
+
+// Writes the wire bytes of a message, omitting the status byte where running status allows
+static uint8_t serialiseMessage(MidiOutQueue* q, MidiOutMessage* message, uint8_t* buffer)
+{
+	uint8_t len = 0;
+	uint32_t now = millis();
+	bool omitStatus = q->useRunningStatus
+							&& message->status < SystemExclusive
+							&& message->status == q->runningStatus
+							&& (now - q->lastTxMs) < MIDI_OUT_RUNNING_STATUS_MS;
+	if(omitStatus)
+	{
+		q->stats.runningStatusSaved++;
+	}
+	else
+	{
+		buffer[len++] = message->status;
+	}
+
+	// Realtime messages may be interleaved without affecting running status,
+	// system common messages cancel it
+	if(message->status < SystemExclusive)
+	{
+		q->runningStatus = message->status;
+	}
+	else if(message->status < Clock)
+	{
+		q->runningStatus = 0;
+	}
+
+	if(message->length > 1)
+	{
+		buffer[len++] = message->data1;
+	}
+	if(message->length > 2)
+	{
+		buffer[len++] = message->data2;
+	}
+	q->lastTxMs = now;
+	return len;
+}
+
+// Builds a 4 byte USB MIDI event packet. The code index number is derived from the status
+static void buildUsbPacket(MidiOutMessage* message, uint8_t* packet)
+{
+	uint8_t cin;
+	if(message->status < SystemExclusive)
+	{
+		cin = message->status >> 4;
+	}
+	else if(message->status >= Clock)
+	{
+		cin = 0x0F;	// Single byte realtime
+	}
+	else if(message->length == 1)
+	{
+		cin = 0x05;	// Single byte system common
+	}
+	else if(message->length == 2)
+	{
+		cin = 0x02;
+	}
+	else
+	{
+		cin = 0x03;
+	}
+	packet[0] = (message->cable << 4) | cin;
+	packet[1] = message->status;
+	packet[2] = message->length > 1 ? message->data1 : 0;
+	packet[3] = message->length > 2 ? message->data2 : 0;
+}
+
+// Builds the next SysEx event packet without consuming it, returns the bytes it carries.
+// A packet that does not end the stream needs three bytes, so a short tail waits for more
+static uint8_t buildSysExPacket(uint8_t* packet)
+{
+	uint8_t length = 0;
+	bool end = false;
+	memset(packet, 0, 4);
+	while(length < 3 && length < usbSysEx.count && !end)
+	{
+		uint8_t data = usbSysEx.buffer[(usbSysEx.head + length) % MIDI_OUT_SYSEX_BUFFER_SIZE];
+		packet[1 + length++] = data;
+		end = data == SystemExclusiveEnd;
+	}
+	if(!end && length < 3)
+	{
+		return 0;
+	}
+	// 0x4 continues the stream, 0x5 - 0x7 end it with one to three bytes
+	uint8_t cin = end ? 0x04 + length : 0x04;
+	packet[0] = (usbSysEx.cable << 4) | cin;
+	return length;
+}
+
+static void popSysEx(uint8_t length, bool end)
+{
+	if(usbSysEx.buffer[usbSysEx.head] == SystemExclusive)
+	{
+		usbSysEx.active = true;
+	}
+	if(end)
+	{
+		usbSysEx.active = false;
+	}
+	usbSysEx.head = (usbSysEx.head + length) % MIDI_OUT_SYSEX_BUFFER_SIZE;
+	usbSysEx.count -= length;
+}
+
+static void drainTrs(MidiOutQueue* q)
+{
+	// The previous batch is still being moved into the UART FIFO
+	if(dma_channel_is_busy(trsDmaChannel))
+	{
+		return;
+	}
+	uint8_t len = 0;
+	MidiOutMessage* message;
+	while(len + 3 <= MIDI_OUT_DMA_BATCH && (message = peekMessage(q)) != NULL)
+	{
+		len += serialiseMessage(q, message, &trsDmaBuffer[len]);
+#ifdef PICOMOD_TRACE
+		trace_OutputFrom(TracePathEdgeToMidiTrs, message->originUs);
+#endif
+		popMessage(q);
+		q->stats.sent++;
+	}
+	if(len)
+	{
+		dma_channel_transfer_from_buffer_now(trsDmaChannel, trsDmaBuffer, len);
+		q->stats.batches++;
+	}
+}
+
+// Packets are held back until the flush policy releases them, then written back to back so
+// TinyUSB sends them in as few transfers as possible. Until the endpoint FIFO accepts a
+// message it stays queued and coalescable. A stalled endpoint only costs one failed write
+static void drainUsb(MidiOutQueue* q, bool flush)
+{
+	// Nothing is listening, stale messages would only arrive as a burst on connection
+	if(!TinyUSBDevice.mounted())
+	{
+		while(peekMessage(q) != NULL)
+		{
+			popMessage(q);
+			q->stats.dropped++;
+		}
+		usbSysEx.count = 0;
+		usbSysEx.active = false;
+		return;
+	}
+	uint16_t pending = usbPendingPackets(q);
+	bool release = flush
+						|| q->priorityCount
+						|| pending >= MIDI_OUT_USB_FRAME_PACKETS
+						|| (micros() - q->pendingSinceUs) >= MIDI_OUT_USB_FLUSH_US;
+	if(pending == 0 || !release)
+	{
+		return;
+	}
+
+	bool written = false;
+	while(true)
+	{
+		uint8_t packet[4];
+		MidiOutMessage* message = peekMessage(q);
+		// Only realtime messages may pass a pending SysEx stream on the same cable
+		bool blocked = message != NULL
+							&& (usbSysEx.active || usbSysEx.count)
+							&& message->cable == usbSysEx.cable
+							&& message->status < Clock;
+		if(message != NULL && !blocked)
+		{
+			buildUsbPacket(message, packet);
+			if(!usb_midi.writePacket(packet))
+			{
+				break;
+			}
+#ifdef PICOMOD_TRACE
+			trace_OutputFrom(TracePathEdgeToMidiUsb, message->originUs);
+#endif
+			popMessage(q);
+			q->stats.sent++;
+		}
+		else
+		{
+			uint8_t length = buildSysExPacket(packet);
+			if(length == 0 || !usb_midi.writePacket(packet))
+			{
+				break;
+			}
+			popSysEx(length, (packet[0] & 0x0F) != 0x04);
+			q->stats.sysExBytes += length;
+		}
+		written = true;
+	}
+	// Anything the FIFO refused is still overdue and is retried on the next call
+	if(written)
+	{
+		q->stats.batches++;
+	}
+}
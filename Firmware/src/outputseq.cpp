@@ -0,0 +1,218 @@
+#include "outputseq.h"
+#include "pico/time.h"
+
+// The GPIO driven outputs, indexed by OutputTarget
+#define NUM_SEQ_OUTPUTS			(OutputAnalogSwitch + 1)
+
+static_assert(OutputBypassRelay == 0 && OutputAuxRelay == 1, "Relays are the first output targets");
+
+typedef enum
+{
+	SeqIdle = 0,
+	SeqMuting,				// Waiting for the mute to take effect
+	SeqSettling				// Waiting for the relays to close and stop bouncing
+} SeqPhase;
+
+typedef struct
+{
+	uint8_t pin;
+	uint16_t settleUs;		// Driven to settled
+} SeqOutput;
+
+static const SeqOutput outputs[NUM_SEQ_OUTPUTS] =
+{
+	{BYPASS_RELAY_PIN, OUTPUT_SEQ_RELAY_OPERATE_US + OUTPUT_SEQ_RELAY_BOUNCE_US},
+	{AUX_RELAY_PIN, OUTPUT_SEQ_RELAY_OPERATE_US + OUTPUT_SEQ_RELAY_BOUNCE_US},
+	{SWITCH_OUT_PIN, OUTPUT_SEQ_ANALOG_SWITCH_US}
+};
+
+static uint8_t wanted[NUM_SEQ_OUTPUTS];
+static uint8_t driven[NUM_SEQ_OUTPUTS];
+static uint16_t digipotValue;
+static bool digipotPending;
+static SeqPhase phase;
+static uint64_t deadline;
+static uint64_t transitionStart;
+static OutputSeqStats stats;
+#ifdef PICOMOD_TRACE
+static uint32_t originUs;				// Dispatch origin of the transition
+#endif
+
+// Private Function Prototypes
+static bool pending();
+static bool relaysMoving();
+static void beginTransition();
+static void driveRelays(uint64_t now);
+static void driveOutput(uint8_t target, uint8_t level);
+static void driveDigipot();
+
+
+//------------------ System ------------------//
+// The outputs are expected low, as picoMod_Init leaves them
+void outputSeq_Init()
+{
+	memset(wanted, 0, sizeof(wanted));
+	memset(driven, 0, sizeof(driven));
+	memset(&stats, 0, sizeof(OutputSeqStats));
+	digipotPending = false;
+	phase = SeqIdle;
+}
+
+void outputSeq_Set(OutputTarget target, uint8_t level)
+{
+	if(target < NUM_SEQ_OUTPUTS)
+	{
+		wanted[target] = level ? 1 : 0;
+	}
+}
+
+// Every value is written, as the digipot was before
+void outputSeq_SetDigipot(uint16_t value)
+{
+	digipotValue = value;
+	digipotPending = true;
+}
+
+// Called at the end of a trigger dispatch
+void outputSeq_Commit()
+{
+	if(phase != SeqIdle)
+	{
+		if(pending())
+		{
+			stats.deferred++;
+		}
+		return;
+	}
+	beginTransition();
+}
+
+// Called from the main loop. Advances a running transition and drives
+// changes made outside of a dispatch
+void outputSeq_Process()
+{
+	if(phase == SeqIdle)
+	{
+		if(pending())
+		{
+			beginTransition();
+		}
+		return;
+	}
+	uint64_t now = time_us_64();
+	if(now < deadline)
+	{
+		return;
+	}
+	if(phase == SeqMuting)
+	{
+		driveRelays(now);
+		return;
+	}
+	driveOutput(OutputAnalogSwitch, wanted[OutputAnalogSwitch]);
+	phase = SeqIdle;
+	uint32_t length = now - transitionStart;
+	if(length > stats.maxTransitionUs)
+	{
+		stats.maxTransitionUs = length;
+	}
+	// Changes that arrived meanwhile
+	if(pending())
+	{
+		beginTransition();
+	}
+}
+
+bool outputSeq_IsIdle()
+{
+	return phase == SeqIdle && !pending();
+}
+
+const OutputSeqStats* outputSeq_GetStats()
+{
+	return &stats;
+}
+
+
+//-------------------- Local Functions --------------------//
+static bool pending()
+{
+	return digipotPending || memcmp(wanted, driven, sizeof(wanted)) != 0;
+}
+
+static bool relaysMoving()
+{
+	return wanted[OutputBypassRelay] != driven[OutputBypassRelay] || wanted[OutputAuxRelay] != driven[OutputAuxRelay];
+}
+
+static void beginTransition()
+{
+#ifdef PICOMOD_TRACE
+	originUs = trace_Origin();
+#endif
+	if(!relaysMoving())
+	{
+		driveOutput(OutputAnalogSwitch, wanted[OutputAnalogSwitch]);
+		driveDigipot();
+		stats.immediate++;
+		return;
+	}
+	stats.transitions++;
+	transitionStart = time_us_64();
+#if OUTPUT_SEQ_MUTE
+	if(driven[OutputAnalogSwitch] != OUTPUT_SEQ_MUTE_LEVEL)
+	{
+		driveOutput(OutputAnalogSwitch, OUTPUT_SEQ_MUTE_LEVEL);
+		deadline = transitionStart + OUTPUT_SEQ_ANALOG_SWITCH_US;
+		phase = SeqMuting;
+		return;
+	}
+#endif
+	driveRelays(transitionStart);
+}
+
+// Every relay that changes moves at once, the wait is for the slowest of them
+static void driveRelays(uint64_t now)
+{
+	uint16_t settleUs = 0;
+	for(uint8_t target=OutputBypassRelay; target<=OutputAuxRelay; target++)
+	{
+		if(wanted[target] != driven[target])
+		{
+			driveOutput(target, wanted[target]);
+			if(outputs[target].settleUs > settleUs)
+			{
+				settleUs = outputs[target].settleUs;
+			}
+		}
+	}
+	driveDigipot();
+	deadline = now + settleUs;
+	phase = SeqSettling;
+}
+
+static void driveOutput(uint8_t target, uint8_t level)
+{
+	if(driven[target] == level)
+	{
+		return;
+	}
+	driven[target] = level;
+	gpio_put(outputs[target].pin, level);
+#ifdef PICOMOD_TRACE
+	trace_OutputFrom(target == OutputAnalogSwitch ? TracePathEdgeToAnalogSwitch : TracePathEdgeToRelay, originUs);
+#endif
+}
+
+static void driveDigipot()
+{
+	if(!digipotPending)
+	{
+		return;
+	}
+	digipotPending = false;
+	mcp41_Write(&digipot, digipotValue);
+#ifdef PICOMOD_TRACE
+	trace_OutputFrom(TracePathEdgeToDigipot, originUs);
+#endif
+}
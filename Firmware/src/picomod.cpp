@@ -1,12 +1,18 @@
 #include "picomod.h"
+#include "schema.h"
+#include "presetbank.h"
+#include "actionpool.h"
+#include "outputseq.h"
 #include "string.h"
+#include "hardware/sync.h"
 
-// USB MIDI object
-Adafruit_USBD_MIDI usb_midi;
+// USB MIDI object, one virtual cable per MidiUsbCable
+Adafruit_USBD_MIDI usb_midi(NUM_MIDI_USB_CABLES);
 
 // Create new instances of the Arduino MIDI Library,
 MIDI_CREATE_INSTANCE(Adafruit_USBD_MIDI, usb_midi, usbMidi);
 MIDI_CREATE_INSTANCE(HardwareSerial, Serial1, trsMidi);
+typedef decltype(trsMidi)::MidiMessage TrsMidiMessage;
 
 // Switch inputs
 Button buttons[NUM_SWITCHES];
@@ -16,14 +22,33 @@ MCP41 digipot;
 
 // Settings and Presets
 GlobalConfig globalConfig;
-Preset preset;
+// The active preset lives in the preset bank and is only ever swapped, never copied
+const Preset* preset;
+const PresetSlot* activePreset;
+PresetState presetState;
 
 // LEDs
 Adafruit_NeoPixel leds(NUM_LEDS, LED_PIN, NEO_GRB + NEO_KHZ800);
 
+// Switch events from the button interrupts, dispatched by the main loop.
+// Everything an action drives is only ever touched from the main loop
+typedef struct
+{
+	uint8_t index;
+	ButtonState state;
+} SwitchEvent;
+
+volatile SwitchEvent switchEvents[SWITCH_EVENT_QUEUE_SIZE];
+volatile uint8_t switchEventHead;
+volatile uint8_t switchEventCount;
+
+// Serial commands. A command sent without its payload takes the next frame
+SerialCommand payloadCommand = NUM_SERIAL_COMMANDS;
+
 // JSON Parsing
-ParsingStatus parsingStatus;
-char serialRxBuffer[JSON_RX_BUFFER_SIZE];
+// Every packet is built in this one static document instead of on the stack.
+// Packets are only handled from the main loop so it is never in use twice
+StaticJsonDocument<JSON_ARENA_SIZE> jsonArena;
 
 
 // Private Function Prototypes
@@ -32,34 +57,94 @@ void picoMod_NewDevice();
 void picoMod_PrintSystem();
 void getFlashUid(char* str);
 void softwareReset();
+void loadPresetState();
 
 void switch1ISR();
 void switch2ISR();
 void switch1Handler(ButtonState state);
 void switch2Handler(ButtonState state);
 void genSwitchHandler(uint8_t index, ButtonState state);
-void processAction(Action* action);
-void processMidiActionEvent(ActionEvent* event);
-void processExpActionEvent(ActionEvent* event);
-void processOutputActionEvent(ActionEvent* event);
-void processLedActionEvent(ActionEvent* event);
+void processSwitchEvents();
 
 void noteOnHandler(byte channel, byte note, byte velocity);
 void noteOffHandler(byte channel, byte note, byte velocity);
 void controlChangeHandler(byte channel, byte number, byte value);
 void programChangeHandler(byte channel, byte number);
 void systemExclusiveHandler(byte* array, unsigned size);
+void trsMirrorHandler(const TrsMidiMessage& message);
+
+CommandResult commandSendGlobal(char* payload);
+CommandResult commandSendPreset(char* payload);
+CommandResult commandPatchPreset(char* payload);
+CommandResult commandReceivePreset(char* payload);
+CommandResult commandReceiveGlobal(char* payload);
+CommandResult commandExpCalStart(char* payload);
+CommandResult commandExpCalEnd(char* payload);
+CommandResult commandMidiStats(char* payload);
+CommandResult commandMemory(char* payload);
+CommandResult commandTrace(char* payload);
+CommandResult commandTraceReset(char* payload);
+CommandResult commandLoopStats(char* payload);
+CommandResult commandManifest(char* payload);
+CommandResult commandPatchBlock(char* payload);
+CommandResult commandPool(char* payload);
+CommandResult commandFlashStats(char* payload);
+void sendCommandResult(CommandResult result);
+
+JsonDocument& acquireJsonArena();
+void releaseJsonArena();
+bool parseAction(JsonVariantConst src, Action* action);
+bool validateAction(const Action* action);
+bool validatePreset(const Preset* preset);
+bool writePresetRecord(uint8_t index, const Preset* record);
+void sendMidiStatsPacket();
+void sendMemoryPacket();
+void sendLoopStatsPacket();
+void sendManifestPacket();
+bool processBlockPacket(char* buffer);
+void sendPoolStatsPacket();
+void sendFlashStatsPacket();
+#ifdef PICOMOD_TRACE
+void sendTracePacket();
+#endif
+
+// Serial command handlers, indexed by SerialCommand.
+// A command that takes a payload accepts it after a space or as the next frame
+typedef struct
+{
+	CommandResult (*handler)(char* payload);
+	bool takesPayload;
+} CommandHandler;
 
-void processGlobalConfigPacket(char* buffer);
-void processPresetPacket(char* buffer);
-void sendGlobalConfigPacket();
-void sendPresetPacket(uint8_t presetIndex);
+const CommandHandler commandHandlers[] =
+{
+	{commandSendGlobal, true},
+	{commandSendPreset, true},
+	{commandPatchPreset, true},
+	{commandReceivePreset, false},
+	{commandReceiveGlobal, false},
+	{commandExpCalStart, false},
+	{commandExpCalEnd, false},
+	{commandMidiStats, false},
+	{commandMemory, false},
+	{commandTrace, false},
+	{commandTraceReset, false},
+	{commandLoopStats, false},
+	{commandManifest, false},
+	{commandPatchBlock, true},
+	{commandPool, false},
+	{commandFlashStats, false}
+};
+static_assert(sizeof(commandHandlers) / sizeof(CommandHandler) == NUM_SERIAL_COMMANDS, "One handler per serial command");
 
 
 //--------------------  --------------------//
 //------------------ System ------------------//
 void picoMod_Init()
 {
+	// Paint the stacks first so the high water covers everything after boot
+	memStats_Init();
+
 	// GPIO config
 	pinMode(SWITCH1_PIN, INPUT_PULLUP);
 	pinMode(SWITCH2_PIN, INPUT_PULLUP);
@@ -74,6 +159,7 @@ void picoMod_Init()
 	digitalWrite(BYPASS_RELAY_PIN, LOW);
 	digitalWrite(AUX_RELAY_PIN, LOW);
 	digitalWrite(SWITCH_OUT_PIN, LOW);
+	outputSeq_Init();
 
 	// Switch inputs
 	buttons[0].mode = Momentary;
@@ -95,11 +181,15 @@ void picoMod_Init()
 
 	// Serial config
 	Serial.begin(9600);
-	parsingStatus = ParsingReady;
+	serialRx_Init();
 
 	// USB device descriptors
 	USBDevice.setManufacturerDescriptor("Pirate MIDI");
 	USBDevice.setProductDescriptor("Pico Mod");
+	// Cable names are numbered from 1
+	usb_midi.setCableName(MidiCableLocal + 1, "Pico Mod");
+	usb_midi.setCableName(MidiCableTrsMirror + 1, "Pico Mod TRS In");
+	usb_midi.setCableName(MidiCableClock + 1, "Pico Mod Clock");
 
 	// Setup Digipot
 	digipot.spi = &SPI;
@@ -107,11 +197,12 @@ void picoMod_Init()
 	digipot.csPin = DIGIPOT_CS;
 	mcp41_Init(&digipot);
 
-	// EEPROM (flash emulation) init with 256 * 256byte sectors assigned
-	EEPROM.begin(256*256);
+	// Flash record storage and the action blocks the presets share
+	storage_Init();
+	actionPool_Init();
 
 	// Read the global config and check if new device
-	EEPROM.get(0, globalConfig);
+	readGlobalConfig();
 	
 	if (globalConfig.bootState == DEVICE_CONFIGURED_VALUE)
 	{
@@ -126,125 +217,152 @@ void picoMod_Init()
 
 	// Begin MIDI listening
 	trsMidi.begin(globalConfig.midiChannel);
+	// Soft thru would write to Serial1 behind the TRS DMA.
+	// TRS input is mirrored to its USB cable instead
+	trsMidi.turnThruOff();
+	trsMidi.setHandleMessage(trsMirrorHandler);
+	trsMidi.setHandleControlChange(controlChangeHandler);
+	trsMidi.setHandleProgramChange(programChangeHandler);
+	trsMidi.setHandleSystemExclusive(systemExclusiveHandler);
 	usbMidi.begin(globalConfig.midiChannel); 
+	// Soft thru would echo the host's messages straight back to it
+	usbMidi.turnThruOff();
+	usbMidi.setHandleControlChange(controlChangeHandler);
+	usbMidi.setHandleProgramChange(programChangeHandler);
+	usbMidi.setHandleSystemExclusive(systemExclusiveHandler);
+	midiOut_Init();
+
+	// Analog expression inputs
+	expInput_Init();
 
 	// Active boot actions
 	processTriggers(TriggerBoot);
 	delay(3000);
 	sendGlobalConfigPacket();
+
+	// Tick deadlines start with the main loop
+	controlTick_Init();
 }
 
-void picoMod_SerialRx(uint16_t len)
+// One pass of the main loop
+void picoMod_Process()
 {
-	// Compare the current parsing state to the received data packet
-	// Prepare for a new packet
-	if(parsingStatus == ParsingReady)
+	// Sleep when the last pass left nothing waiting. This is at the start of the
+	// pass so the USB stack has run after the previous one
+	if(!switchEventCount && !serialRx_Pending() && midiOut_IsIdle() && outputSeq_IsIdle() && Serial1.available() <= 0 && usb_midi.available() <= 0)
 	{
-		// Prepare to receive global settings
-		if(strcmp(serialRxBuffer, "sendGlobal") == 0)
-		{
-			parsingStatus = ParsingGlobal;
-			Serial.println("ok");
-		}
-		// Prepare to receive a preset
-		else if(strcmp(serialRxBuffer, "sendPreset") == 0)
-		{
-			parsingStatus = ParsingPreset;
-			Serial.println("ok");
-		}
-		// Request to send the global config settings
-		else if(strcmp(serialRxBuffer, "receivePreset") == 0)
-		{
-			sendPresetPacket(globalConfig.currentPreset);
-		}
-		// Request to send the preset data
-		else if(strcmp(serialRxBuffer, "receiveGlobal") == 0)
-		{
-			sendGlobalConfigPacket();
-		}
-		else
-		{
-			Serial.println("error");
-		}
+		controlTick_Sleep();
 	}
-	// Receive a global config packet
-	else if(parsingStatus == ParsingGlobal)
+	// Dispatch footswitch events queued by the switch interrupts
+	processSwitchEvents();
+	// Frame and dispatch configuration commands
+	serialRx_Process();
+	// Mirror TRS input to its USB cable and dispatch both ports to the MIDI callbacks
+	trsMidi.read();
+	usbMidi.read();
+	// Fixed rate work
+	if(controlTick_Due())
 	{
-		processGlobalConfigPacket(serialRxBuffer);
-		parsingStatus = ParsingReady;
-		Serial.println("ok");
+		// Reduce the DMA sampled expression inputs and send any changes
+		expInput_Process();
+		controlTick_Done();
 	}
-	// Receive a preset packet
-	else if(parsingStatus == ParsingPreset)
+	// Feed queued MIDI to the transports without blocking
+	midiOut_Process();
+	// Step any output transition whose settle time has passed
+	outputSeq_Process();
+	// Refill the preset window after a preset change
+	presetBank_Process();
+}
+
+// Dispatches one received frame: either a command, optionally followed by a space
+// and its JSON payload, or the payload of the previous command
+void picoMod_SerialRx(char* frame, uint16_t len)
+{
+	if(payloadCommand < NUM_SERIAL_COMMANDS)
 	{
-		processPresetPacket(serialRxBuffer);
-		parsingStatus = ParsingReady;
-		Serial.println("ok");
+		SerialCommand command = payloadCommand;
+		payloadCommand = NUM_SERIAL_COMMANDS;
+		sendCommandResult(commandHandlers[command].handler(frame));
+		return;
 	}
-	// Flush the buffer
-	for(uint16_t i=0; i<len; i++)
+
+	char* payload = (char*)memchr(frame, ' ', len);
+	if(payload)
 	{
-		serialRxBuffer[i] = 0;
+		*payload++ = 0;
 	}
+	uint8_t command;
+	if(!serialCommandSchema.toValue(frame, &command))
+	{
+		sendCommandResult(CommandError);
+		return;
+	}
+	if(commandHandlers[command].takesPayload && payload == NULL)
+	{
+		payloadCommand = (SerialCommand)command;
+		sendCommandResult(CommandOk);
+		return;
+	}
+	sendCommandResult(commandHandlers[command].handler(payload));
 }
 
 
 //------------------ GPIO -------------------//
-// These functions are wrappers for the onboard GPIO.
-// A slight performance overhead is incurred due to the additional function call,
-// however, for an inexperienced embedded programmer, they may be easier to use.
+// These functions are wrappers for the onboard outputs. They update the runtime
+// state at once, the output sequencer drives the pins when the dispatch ends.
 void relayBypassOn()
 {
-	preset.bypassRelayState = 1;
-	gpio_put(BYPASS_RELAY_PIN, 1);
+	presetState.bypassRelayState = 1;
+	outputSeq_Set(OutputBypassRelay, presetState.bypassRelayState);
 }
 
 void relayBypassOff()
 {
-	preset.bypassRelayState = 0;
-	gpio_put(BYPASS_RELAY_PIN, LOW);
+	presetState.bypassRelayState = 0;
+	outputSeq_Set(OutputBypassRelay, presetState.bypassRelayState);
 }
 
 void relayBypassToggle()
 {
-	preset.bypassRelayState =! preset.bypassRelayState;
-	gpio_put(BYPASS_RELAY_PIN, preset.bypassRelayState);
+	presetState.bypassRelayState = !presetState.bypassRelayState;
+	outputSeq_Set(OutputBypassRelay, presetState.bypassRelayState);
 }
 
 void relayAuxOn()
 {
-	preset.auxRelayState = 1;
-	gpio_put(AUX_RELAY_PIN, 1);
+	presetState.auxRelayState = 1;
+	outputSeq_Set(OutputAuxRelay, presetState.auxRelayState);
 }
 
 void relayAuxOff()
 {
-	preset.auxRelayState = 0;
-	gpio_put(AUX_RELAY_PIN, 0);
+	presetState.auxRelayState = 0;
+	outputSeq_Set(OutputAuxRelay, presetState.auxRelayState);
 }
 
 void relayAuxToggle()
 {
-	preset.auxRelayState =! preset.auxRelayState;
-	gpio_put(BYPASS_RELAY_PIN, preset.auxRelayState);
+	presetState.auxRelayState = !presetState.auxRelayState;
+	outputSeq_Set(OutputAuxRelay, presetState.auxRelayState);
 }
 
 void analogSwitchOn()
 {
-	preset.analogSwitchState = 1;
-	gpio_put(AUX_RELAY_PIN, 1);
+	presetState.analogSwitchState = 1;
+	outputSeq_Set(OutputAnalogSwitch, presetState.analogSwitchState);
 }
 
 void analogSwitchOff()
 {
-	preset.analogSwitchState = 0;
-	gpio_put(AUX_RELAY_PIN, 0);
+	presetState.analogSwitchState = 0;
+	outputSeq_Set(OutputAnalogSwitch, presetState.analogSwitchState);
 }
 
 void analogSwitchToggle()
 {
-	preset.analogSwitchState =! preset.analogSwitchState;
-	gpio_put(BYPASS_RELAY_PIN, preset.analogSwitchState);
+	presetState.analogSwitchState = !presetState.analogSwitchState;
+	outputSeq_Set(OutputAnalogSwitch, presetState.analogSwitchState);
 }
 
 bool getSwitch1State()
@@ -259,204 +377,132 @@ bool getSwitch2State()
 
 
 //------------ Preset Management ------------//
+// Points the active preset at the bank slot for globalConfig.currentPreset
 void readCurrentPreset()
 {
-  EEPROM.get(sizeof(GlobalConfig) + sizeof(Preset) * globalConfig.currentPreset, preset);
+  activePreset = presetBank_Select(globalConfig.currentPreset);
+  preset = &activePreset->preset;
+  loadPresetState();
 }
 
+// Stores the runtime state back into the current preset
 void saveCurrentPreset()
 {
-  EEPROM.put(sizeof(GlobalConfig) + sizeof(Preset) * globalConfig.currentPreset,
-                preset);
-  EEPROM.commit();
-  delay(1);
+  Preset record = *preset;
+  record.expValue = presetState.expValue;
+  record.switch1State = presetState.switch1State;
+  record.switch2State = presetState.switch2State;
+  record.analogSwitchState = presetState.analogSwitchState;
+  record.bypassRelayState = presetState.bypassRelayState;
+  record.auxRelayState = presetState.auxRelayState;
+  actionPool_StorePreset(globalConfig.currentPreset, &record);
+  presetBank_Invalidate(globalConfig.currentPreset);
 }
 
+// The current preset logged since the global config was last saved takes precedence
 void readGlobalConfig()
 {
-  EEPROM.get(sizeof(GlobalConfig) + sizeof(Preset) * globalConfig.currentPreset,
-                preset);
+  storage_Read(StorageRecordGlobal, 0, &globalConfig, sizeof(GlobalConfig));
+  uint8_t logged;
+  if(storage_ReadCurrentPreset(&logged) && logged < NUM_PRESETS)
+  {
+    globalConfig.currentPreset = logged;
+  }
 }
 
 void saveGlobalConfig()
 {
-  EEPROM.put(0, globalConfig);
-  EEPROM.commit();
+  storage_Write(StorageRecordGlobal, 0, &globalConfig, sizeof(GlobalConfig));
+  storage_WriteCurrentPreset(globalConfig.currentPreset);
+  storage_Commit();
+}
+
+// Preset changes only log the new index, the global config record is left as it is
+void saveCurrentPresetIndex()
+{
+  storage_WriteCurrentPreset(globalConfig.currentPreset);
+  storage_Commit();
 }
 
 void presetUp()
 {
+  TRACE_BEGIN(changeStart);
 	// Handle any actions triggered by the bank exit
   processTriggers(TriggerExitBank);
-  // Increment presets
-  if(globalConfig.currentPreset >= NUM_PRESETS)
-  {
-    globalConfig.currentPreset = 0;
-  }
-  else
-  {
-    globalConfig.currentPreset++;
-  }
+  // Increment presets, wrapping to the first
+  globalConfig.currentPreset = presetBank_Next(globalConfig.currentPreset);
   readCurrentPreset();
-  saveGlobalConfig();
+  saveCurrentPresetIndex();
   // Handle any actions triggered by the bank entry
   processTriggers(TriggerEnterBank);
+  TRACE_END(TracePathPresetChange, changeStart);
 }
 
 void presetDown()
 {
+  TRACE_BEGIN(changeStart);
 	// Handle any actions triggered by the bank exit
   processTriggers(TriggerExitBank);
-  // Increment presets
-  if(globalConfig.currentPreset == 0)
-  {
-    globalConfig.currentPreset = NUM_PRESETS;
-  }
-  else
-  {
-    globalConfig.currentPreset--;
-  }
+  // Decrement presets, wrapping to the last
+  globalConfig.currentPreset = presetBank_Previous(globalConfig.currentPreset);
   readCurrentPreset();
-  saveGlobalConfig();
+  saveCurrentPresetIndex();
   // Handle any actions triggered by the bank entry
   processTriggers(TriggerEnterBank);
+  TRACE_END(TracePathPresetChange, changeStart);
 }
 
 void goToPreset(uint8_t newPreset)
 {
-  if(newPreset > NUM_PRESETS)
+  if(newPreset >= NUM_PRESETS)
   {
     return;
   }
+  TRACE_BEGIN(changeStart);
   // Handle any actions triggered by the bank exit
   processTriggers(TriggerExitBank);
   globalConfig.currentPreset = newPreset;
   readCurrentPreset();
-  saveGlobalConfig();
+  saveCurrentPresetIndex();
   // Handle any actions triggered by the bank entry
   processTriggers(TriggerEnterBank);
+  TRACE_END(TracePathPresetChange, changeStart);
 }
 
 
 //----------- Action Handling -----------//
+// Triggers without an input event or value: boot and bank changes
 void processTriggers(TriggerType triggerType)
 {
-	// Check for any assigned actions
-	for(uint8_t action=0; action<preset.numActions; action++)
-	{
-		// Corresponding TriggerType enum matches the switch index
-		if(preset.actions[action].trigger.type == triggerType)
-		{
-			processAction(&preset.actions[action]);
-		}
-	}
-}
-
-void processAction(Action* action)
-{
-	switch(action->type)
-	{
-		case ActionEventMidi:
-		processMidiActionEvent(&action->event);
-		break;
-
-		case ActionEventExp:
-		processExpActionEvent(&action->event);
-		break;
-
-		case ActionEventOutput:
-		processOutputActionEvent(&action->event);
-		break;
-
-		case ActionEventLed:
-		processLedActionEvent(&action->event);
-		break;
-	}
-}
-
-void processMidiActionEvent(ActionEvent* event)
-{
-	trsMidi.send(	event->midiMessage.type,
-						event->midiMessage.data1,
-						event->midiMessage.data2,
-						event->midiMessage.channel);
+	processTriggerInput(triggerType, 0, 0);
 }
 
-void processExpActionEvent(ActionEvent* event)
+// Runs the trigger's compiled actions. number is the button event or controller number
+// the actions match against, value is what conditions and value operations read
+void processTriggerInput(TriggerType triggerType, uint8_t number, uint8_t value)
 {
-	mcp41_Write(&digipot, event->expMessage.value);
-}
-
-void processOutputActionEvent(ActionEvent* event)
-{
-	OutputTarget target = event->outputMessage.target;
-	OutputValue value = event->outputMessage.value;
-	switch(target)
+	TRACE_BEGIN(triggersStart);
+	// No preset is loaded between configuring a new device and its reset
+	if(activePreset != NULL)
 	{
-		case OutputBypassRelay:
-		if(value == OutputOn)
-		{
-			relayBypassOn();
-		}
-		else if(value == OutputOff)
-		{
-			relayBypassOff();
-		}
-		else if(value == OutputToggle)
-		{
-			relayBypassToggle();
-		}
-		break;
-
-		case OutputAuxRelay:
-		if(value == OutputOn)
-		{
-			relayAuxOn();
-		}
-		else if(value == OutputOff)
-		{
-			relayAuxOff();
-		}
-		else if(value == OutputToggle)
-		{
-			relayAuxToggle();
-		}
-		break;
-
-		case OutputAnalogSwitch:
-		if(value == OutputOn)
-		{
-			analogSwitchOn();
-		}
-		else if(value == OutputOff)
-		{
-			analogSwitchOff();
-		}
-		else if(value == OutputToggle)
-		{
-			analogSwitchToggle();
-		}
-		break;
+		actionCode_Run(&activePreset->program, triggerType, number, value);
 	}
-}
-
-void processLedActionEvent(ActionEvent* event)
-{
-	leds.setPixelColor(event->ledMessage.index, event->ledMessage.colour);
-	leds.show();
+	// The trigger's output changes move together as one transition
+	outputSeq_Commit();
+	// The trigger's USB messages leave together rather than waiting for the deadline
+	midiOut_Flush();
+	TRACE_END(TracePathTriggers, triggersStart);
 }
 
 
 //-------------------- Local Functions --------------------//
 //------------------ System ------------------//
-// Standard boot procedure and EEPROM recall
+// Standard boot procedure and flash recall
 void picoMod_Boot()
 {
-  // Read the preset data
-  for (uint8_t i = 0; i < NUM_PRESETS; i++)
-  {
-    EEPROM.get(sizeof(GlobalConfig) + sizeof(Preset) * i, preset);
-  }
+  // Load the current preset and its neighbours
+  presetBank_Init(globalConfig.currentPreset);
+  readCurrentPreset();
 }
 
 // Configures the device to the default state
@@ -466,27 +512,33 @@ void picoMod_NewDevice()
 	globalConfig.currentPreset = 0;
 	globalConfig.midiChannel = MIDI_CHANNEL_OMNI;
 	strcpy(globalConfig.deviceName, DEFAULT_DEVICE_NAME);
-	// Save the default config to eeprom
-	EEPROM.put(0, globalConfig);
-
-	// Initialise all presets to contain no actions and default states
+	for(uint8_t i=0; i<NUM_EXP_INPUTS; i++)
+	{
+		globalConfig.expInputs[i].mode = ExpInputOff;
+		globalConfig.expInputs[i].channel = 1;
+		globalConfig.expInputs[i].ccNumber = 11 + i;
+		globalConfig.expInputs[i].calMin = 0;
+		globalConfig.expInputs[i].calMax = EXP_ADC_MAX;
+	}
+	// Save the default config to flash
+	storage_Write(StorageRecordGlobal, 0, &globalConfig, sizeof(GlobalConfig));
+	storage_ResetCurrentPreset(globalConfig.currentPreset);
+
+	// Initialise all presets to contain no actions and default states.
+	// Nothing references the action pool afterwards, it is recounted after the reset
+	PresetRecord defaults;
+	memset(&defaults, 0, sizeof(PresetRecord));
+	defaults.expValue = 127;
+	for(uint8_t j=0; j<NUM_SWITCH_ACTIONS; j++)
+	{
+		defaults.actions[j] = ACTION_BLOCK_NONE;
+	}
 	for (uint8_t i = 0; i < NUM_PRESETS; i++)
 	{
-		preset.expValue = 127;
-		preset.switch1State = 0;
-		preset.switch2State = 0;
-		preset.analogSwitchState = 0;
-		preset.bypassRelayState = 0;
-		preset.auxRelayState = 0;
-		preset.numActions = 0;
-		for(uint8_t j=0; j<NUM_SWITCH_ACTIONS; j++)
-		{
-			preset.actions[j].trigger.type = TriggerNone;
-		}
-		EEPROM.put(sizeof(GlobalConfig) + sizeof(Preset) * i, preset);
+		storage_Write(StorageRecordPreset, i, &defaults, sizeof(PresetRecord));
 	}
 
-	EEPROM.commit();
+	storage_Commit();
 	softwareReset();
 }
 
@@ -519,15 +571,28 @@ void softwareReset()
   watchdog_reboot(0, 0, 0);
 }
 
+// Takes the runtime state from the stored copy of the active preset
+void loadPresetState()
+{
+	presetState.expValue = preset->expValue;
+	presetState.switch1State = preset->switch1State;
+	presetState.switch2State = preset->switch2State;
+	presetState.analogSwitchState = preset->analogSwitchState;
+	presetState.bypassRelayState = preset->bypassRelayState;
+	presetState.auxRelayState = preset->auxRelayState;
+}
+
 
 //------------- Switch Inputs -------------//
 void switch1ISR()
 {
+	TRACE_INPUT_EDGE(0);
 	buttons_ExtiGpioCallback(&buttons[0], ButtonEmulateNone);
 }
 
 void switch2ISR()
 {
+	TRACE_INPUT_EDGE(1);
 	buttons_ExtiGpioCallback(&buttons[1], ButtonEmulateNone);
 }
 
@@ -541,23 +606,54 @@ void switch2Handler(ButtonState state)
 	genSwitchHandler(1, state);
 }
 
+// Runs in interrupt context (the GPIO ISR or the buttons library's timer), so the
+// event is only queued. An event that finds the queue full is dropped
 void genSwitchHandler(uint8_t index, ButtonState state)
 {
-	processTriggers((TriggerType)index);
+	uint32_t irqState = save_and_disable_interrupts();
+	if(switchEventCount < SWITCH_EVENT_QUEUE_SIZE)
+	{
+		uint8_t slot = (switchEventHead + switchEventCount) % SWITCH_EVENT_QUEUE_SIZE;
+		switchEvents[slot].index = index;
+		switchEvents[slot].state = state;
+		switchEventCount++;
+	}
+	restore_interrupts(irqState);
+}
+
+void processSwitchEvents()
+{
+	while(switchEventCount)
+	{
+		uint32_t irqState = save_and_disable_interrupts();
+		SwitchEvent event;
+		event.index = switchEvents[switchEventHead].index;
+		event.state = switchEvents[switchEventHead].state;
+		switchEventHead = (switchEventHead + 1) % SWITCH_EVENT_QUEUE_SIZE;
+		switchEventCount--;
+		restore_interrupts(irqState);
+
+		TRACE_DISPATCH_INPUT(event.index);
+		// Corresponding TriggerType enum matches the switch index
+		processTriggerInput((TriggerType)event.index, event.state, event.state == ButtonRelease ? 0 : 127);
+		TRACE_DISPATCH_END();
+	}
 }
 
 
 //------------ MIDI Callbacks ------------//
 void controlChangeHandler(byte channel, byte number, byte value)
 {
-	processTriggers(TriggerCC);
+	processTriggerInput(TriggerCC, number, value);
 }
 
 void programChangeHandler(byte channel, byte number)
 {
 	if (number < NUM_PRESETS)
 	{
+		TRACE_DISPATCH_BEGIN(time_us_32());
 		goToPreset(number);
+		TRACE_DISPATCH_END();
 	}
 }
 
@@ -566,13 +662,181 @@ void systemExclusiveHandler(byte* array, unsigned size)
 
 }
 
+void trsMirrorHandler(const TrsMidiMessage& message)
+{
+	if(message.type == MIDI_NAMESPACE::SystemExclusive)
+	{
+		midiOut_SendUsbSysEx(MidiCableTrsMirror, message.sysexArray, message.getSysExSize());
+	}
+	else
+	{
+		midiOut_SendUsb(MidiCableTrsMirror, message.type, message.data1, message.data2, message.channel);
+	}
+}
+
+
+//------------ Serial Commands ------------//
+CommandResult commandSendGlobal(char* payload)
+{
+	return processGlobalConfigPacket(payload) ? CommandOk : CommandError;
+}
+
+CommandResult commandSendPreset(char* payload)
+{
+	return processPresetPacket(payload) ? CommandOk : CommandError;
+}
+
+// Partial preset edit
+CommandResult commandPatchPreset(char* payload)
+{
+	return processPresetPatchPacket(payload) ? CommandOk : CommandError;
+}
+
+// The current preset, or the one given as {"index":n}
+CommandResult commandReceivePreset(char* payload)
+{
+	uint16_t index = globalConfig.currentPreset;
+	if(payload)
+	{
+		JsonDocument& json = acquireJsonArena();
+		DeserializationError error = deserializeJson(json, payload);
+		index = error ? NUM_PRESETS : json["index"] | index;
+		releaseJsonArena();
+	}
+	if(index >= NUM_PRESETS)
+	{
+		return CommandError;
+	}
+	sendPresetPacket(index);
+	return CommandReplied;
+}
+
+CommandResult commandReceiveGlobal(char* payload)
+{
+	sendGlobalConfigPacket();
+	return CommandReplied;
+}
+
+// Capture the expression input travel while the user sweeps each pedal
+CommandResult commandExpCalStart(char* payload)
+{
+	expInput_StartCalibration();
+	return CommandOk;
+}
+
+CommandResult commandExpCalEnd(char* payload)
+{
+	expInput_EndCalibration();
+	saveGlobalConfig();
+	sendGlobalConfigPacket();
+	return CommandReplied;
+}
+
+// Outbound MIDI queue counters
+CommandResult commandMidiStats(char* payload)
+{
+	sendMidiStatsPacket();
+	return CommandReplied;
+}
+
+// RAM, heap, stack, JSON arena and receive buffer usage
+CommandResult commandMemory(char* payload)
+{
+	sendMemoryPacket();
+	return CommandReplied;
+}
+
+// Latency histograms and the most recent trace entries
+CommandResult commandTrace(char* payload)
+{
+#ifdef PICOMOD_TRACE
+	sendTracePacket();
+	return CommandReplied;
+#else
+	return CommandError;
+#endif
+}
+
+CommandResult commandTraceReset(char* payload)
+{
+#ifdef PICOMOD_TRACE
+	trace_Reset();
+	return CommandOk;
+#else
+	return CommandError;
+#endif
+}
+
+// Control tick timing, main loop idle time and output transitions
+CommandResult commandLoopStats(char* payload)
+{
+	sendLoopStatsPacket();
+	return CommandReplied;
+}
+
+// Content hashes of the global config and every preset, for the editor to
+// fetch or send only the records that differ from its copy
+CommandResult commandManifest(char* payload)
+{
+	sendManifestPacket();
+	return CommandReplied;
+}
+
+// Rewrites one shared action block, {"block": n, <full action>}.
+// The change applies to every preset using the block
+CommandResult commandPatchBlock(char* payload)
+{
+	return processBlockPacket(payload) ? CommandOk : CommandError;
+}
+
+// Action pool usage
+CommandResult commandPool(char* payload)
+{
+	sendPoolStatsPacket();
+	return CommandReplied;
+}
+
+// Flash erases, programs and stalls since boot, with the wear they project
+CommandResult commandFlashStats(char* payload)
+{
+	sendFlashStatsPacket();
+	return CommandReplied;
+}
+
+void sendCommandResult(CommandResult result)
+{
+	if(result == CommandOk)
+	{
+		Serial.println("ok");
+	}
+	else if(result == CommandError)
+	{
+		Serial.println("error");
+	}
+}
+
 
 //------------ JSON Handling ------------//
-void processGlobalConfigPacket(char* buffer)
+// Clears the shared arena for a new packet
+JsonDocument& acquireJsonArena()
+{
+	jsonArena.clear();
+	return jsonArena;
+}
+
+// Records how much of the arena the packet needed, so its size can be checked against real presets
+void releaseJsonArena()
 {
-	// Allocate the JSON document
-	// If you add custom handling, ensure you allow enough memory
-	StaticJsonDocument<100> json;
+	memStats_RecordJsonArena(jsonArena.capacity(), jsonArena.memoryUsage(), jsonArena.overflowed());
+	jsonArena.clear();
+}
+
+// The reply to the command is its only output, a rejected packet changes nothing
+bool processGlobalConfigPacket(char* buffer)
+{
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
 
 	// Deserialize the JSON document
 	DeserializationError error = deserializeJson(json, buffer);
@@ -580,28 +844,58 @@ void processGlobalConfigPacket(char* buffer)
 	// Test if parsing succeeds.
 	if (error)
 	{
-		Serial.print(F("deserializeJson() failed: "));
-		Serial.println(error.f_str());
-		return;
+		releaseJsonArena();
+		return false;
 	}
-	// Device name
-	const char* newDeviceName = json["deviceName"];
-	strcpy(globalConfig.deviceName, newDeviceName);
+	GlobalConfig incoming = globalConfig;
+
+	// Device name, cut to the stored length
+	const char* newDeviceName = json["deviceName"] | "";
+	strncpy(incoming.deviceName, newDeviceName, DEVICE_NAME_LEN);
+	incoming.deviceName[DEVICE_NAME_LEN] = 0;
 
 	// MIDI channel
-	globalConfig.midiChannel = json["midiChannel"];
+	incoming.midiChannel = json["midiChannel"];
 
-	Serial.print("New device name: ");
-	Serial.println(globalConfig.deviceName);
-	Serial.print("MIDI Channel: ");
-	Serial.println(globalConfig.midiChannel);
-}	
+	// Expression inputs are optional in the packet
+	bool known = true;
+	bool expInputs = json.containsKey("expInputs");
+	if(expInputs)
+	{
+		for(uint8_t i=0; i<NUM_EXP_INPUTS; i++)
+		{
+			incoming.expInputs[i].mode = (ExpInputMode)schema_Read(json["expInputs"][i]["mode"], expInputModeSchema, ExpInputOff, &known);
+			incoming.expInputs[i].channel = json["expInputs"][i]["channel"];
+			incoming.expInputs[i].ccNumber = json["expInputs"][i]["ccNumber"];
+			incoming.expInputs[i].calMin = json["expInputs"][i]["calMin"] | 0;
+			incoming.expInputs[i].calMax = json["expInputs"][i]["calMax"] | EXP_ADC_MAX;
+		}
+	}
+	releaseJsonArena();
 
-void processPresetPacket(char* buffer)
+	if(!known)
+	{
+		return false;
+	}
+	// Only a change is written, resending the same config costs no flash
+	if(memcmp(&incoming, &globalConfig, sizeof(GlobalConfig)) != 0)
+	{
+		globalConfig = incoming;
+		saveGlobalConfig();
+	}
+	if(expInputs)
+	{
+		expInput_Init();
+	}
+	return true;
+}
+
+// Fails when the action pool has no room for the preset's new actions
+bool processPresetPacket(char* buffer)
 {
-	// Allocate the JSON document
-	// If you add custom handling, ensure you allow enough memory
-	StaticJsonDocument<4096> json;
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
 
 	// Deserialize the JSON document
 	DeserializationError error = deserializeJson(json, buffer);
@@ -609,160 +903,583 @@ void processPresetPacket(char* buffer)
 	// Test if parsing succeeds
 	if (error)
 	{
-		Serial.print(F("deserializeJson() failed: "));
-		Serial.println(error.f_str());
-		return;
+		releaseJsonArena();
+		return false;
 	}
 
-	// Record the current preset number and preserve the current preset
-	uint8_t currentPreset = globalConfig.currentPreset;
-	saveCurrentPreset();
-
-	// Find the target preset for the incoming packet and load it
-	uint8_t newPreset = json["index"];
-	globalConfig.currentPreset = newPreset;
-	readCurrentPreset();
+	// The packet is built on top of the stored preset
+	uint16_t index = json["index"];
+	if(index >= NUM_PRESETS)
+	{
+		releaseJsonArena();
+		return false;
+	}
+	Preset incoming;
+	actionPool_LoadPreset(index, &incoming);
 
 	// Process the preset data
-	preset.id = json["id"];
-	preset.expValue = json["expValue"];
-	preset.switch1State = json["switch1State"];
-	preset.switch2State = json["switch2State"];
-	preset.bypassRelayState = json["bypassRelayState"];
-	preset.auxRelayState = json["auxRelayState"];
-	preset.analogSwitchState = json["analogSwitchState"];
-	preset.numActions = json["numActions"];
+	incoming.id = json["id"];
+	incoming.expValue = json["expValue"];
+	incoming.switch1State = json["switch1State"];
+	incoming.switch2State = json["switch2State"];
+	incoming.bypassRelayState = json["bypassRelayState"];
+	incoming.auxRelayState = json["auxRelayState"];
+	incoming.analogSwitchState = json["analogSwitchState"];
+	// A list the preset cannot hold, or one shorter than its count, is refused rather than
+	// truncated, so the editor never believes actions were stored that were dropped
+	uint16_t numActions = json["numActions"];
+	if(numActions > NUM_SWITCH_ACTIONS || numActions > json["actions"].size())
+	{
+		releaseJsonArena();
+		return false;
+	}
+	incoming.numActions = numActions;
 
-	// Process all actions
-	for(uint16_t i=0; i<preset.numActions; i++)
+	// Process all actions, held to the same ranges as a patch
+	bool valid = true;
+	for(uint16_t i=0; i<incoming.numActions && valid; i++)
 	{
-		// Action trigger
-		preset.actions[i].trigger.type = json["actions"][i]["trigger"]["type"];
-		// Button input triggers require the button state
-		if(preset.actions[i].trigger.type <= TriggerGpio7)
+		valid = parseAction(json["actions"][i], &incoming.actions[i]) && validateAction(&incoming.actions[i]);
+	}
+	releaseJsonArena();
+	if(!valid || !validatePreset(&incoming))
+	{
+		return false;
+	}
+
+	// Save the preset data and refresh it if it is resident
+	if(!writePresetRecord(index, &incoming))
+	{
+		return false;
+	}
+	if(index == globalConfig.currentPreset)
+	{
+		loadPresetState();
+	}
+	return true;
+}
+
+// Applies a partial edit to one stored preset without touching any other preset.
+// {"index": n, <any top level preset fields>, "actions": [{"n": slot, <full action>}, ...]}
+// Everything is validated before anything is written, and only the bytes that differ
+// from the stored record are rewritten. Edits to the current preset take effect immediately
+bool processPresetPatchPacket(char* buffer)
+{
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+
+	// Deserialize the JSON document
+	DeserializationError error = deserializeJson(json, buffer);
+
+	// Test if parsing succeeds
+	if (error)
+	{
+		releaseJsonArena();
+		return false;
+	}
+
+	uint16_t index = json["index"] | NUM_PRESETS;
+	if(index >= NUM_PRESETS)
+	{
+		releaseJsonArena();
+		return false;
+	}
+
+	// Work on a copy so a rejected patch leaves the record untouched
+	Preset patched;
+	actionPool_LoadPreset(index, &patched);
+
+	// Preset fields that are missing keep their stored value
+	patched.id = json["id"] | patched.id;
+	patched.expValue = json["expValue"] | patched.expValue;
+	patched.switch1State = json["switch1State"] | patched.switch1State;
+	patched.switch2State = json["switch2State"] | patched.switch2State;
+	patched.bypassRelayState = json["bypassRelayState"] | patched.bypassRelayState;
+	patched.auxRelayState = json["auxRelayState"] | patched.auxRelayState;
+	patched.analogSwitchState = json["analogSwitchState"] | patched.analogSwitchState;
+
+	// Replaced actions. Writing the slot just past the end appends to the action list,
+	// a slot further out would leave unset actions in between
+	bool valid = true;
+	for(uint16_t i=0; i<json["actions"].size() && valid; i++)
+	{
+		uint16_t slot = json["actions"][i]["n"] | NUM_SWITCH_ACTIONS;
+		if(slot >= NUM_SWITCH_ACTIONS || slot > patched.numActions)
 		{
-			preset.actions[i].trigger.value.buttonTrigger = json["actions"][i]["trigger"]["value"];
+			valid = false;
+			break;
 		}
-		// MIDI CC triggers require the CC number and value
-		else if(preset.actions[i].trigger.type == TriggerCC)
+		valid = parseAction(json["actions"][i], &patched.actions[slot]) && validateAction(&patched.actions[slot]);
+		if(slot == patched.numActions)
 		{
-			preset.actions[i].trigger.value.midiTrigger.midiNum = json["actions"][i]["trigger"]["number"];
-			preset.actions[i].trigger.value.midiTrigger.midiValue = json["actions"][i]["trigger"]["value"];
+			patched.numActions++;
 		}
-		// Action event type
-		preset.actions[i].type = json["actions"][i]["type"];
+	}
+	// The action count may shorten the list, only appended actions lengthen it
+	uint16_t numActions = json["numActions"] | patched.numActions;
+	releaseJsonArena();
 
-		// Action event
-		// MIDI event
-		if(preset.actions[i].type == ActionEventMidi)
+	if(!valid || numActions > patched.numActions || !validatePreset(&patched))
+	{
+		return false;
+	}
+	patched.numActions = numActions;
+
+	if(!writePresetRecord(index, &patched))
+	{
+		return false;
+	}
+	if(index == globalConfig.currentPreset)
+	{
+		loadPresetState();
+	}
+	return true;
+}
+
+// Fills every field of an action from its JSON object. Returns false if a named
+// field holds a name the schema does not know.
+// Cleared first so equal actions are equal byte for byte and share a pool block
+bool parseAction(JsonVariantConst src, Action* action)
+{
+	bool known = true;
+	memset(action, 0, sizeof(Action));
+	// Action trigger
+	action->trigger.type = (TriggerType)schema_Read(src["trigger"]["type"], triggerTypeSchema, TriggerNone, &known);
+	// Button input triggers require the button state
+	if(action->trigger.type <= TriggerGpio7)
+	{
+		action->trigger.value.buttonTrigger = (ButtonState)schema_Read(src["trigger"]["value"], buttonStateSchema, ButtonPress, &known);
+	}
+	// MIDI CC triggers require the CC number and value
+	else if(action->trigger.type == TriggerCC)
+	{
+		action->trigger.value.midiTrigger.midiNum = src["trigger"]["number"];
+		action->trigger.value.midiTrigger.midiValue = src["trigger"]["value"];
+	}
+	// Optional condition and value operation, older editors send neither
+	action->condition = schema_Read(src["condition"], actionConditionSchema, ConditionAlways, &known);
+	action->conditionValue = src["conditionValue"] | 0;
+	action->valueOp = schema_Read(src["valueOp"], actionValueSchema, ValueFixed, &known);
+	// Action event type
+	action->type = (ActionEventType)schema_Read(src["type"], actionEventSchema, ActionEventMidi, &known);
+
+	// Action event
+	// MIDI event
+	if(action->type == ActionEventMidi)
+	{
+		action->event.midiMessage.channel = src["event"]["channel"];
+		action->event.midiMessage.type = (MIDI_NAMESPACE::MidiType)schema_Read(src["event"]["type"], midiTypeSchema, MIDI_NAMESPACE::InvalidType, &known);
+		action->event.midiMessage.data1 = src["event"]["data1"];
+		action->event.midiMessage.data2 = src["event"]["data2"];
+		action->event.midiMessage.destination = schema_Read(src["event"]["destination"], midiDestinationSchema, MidiDestTrs, &known);
+	}
+	// Expression event
+	else if(action->type == ActionEventExp)
+	{
+		action->event.expMessage.value = src["event"]["value"];
+	}
+	// Output event
+	else if(action->type == ActionEventOutput)
+	{
+		action->event.outputMessage.target = (OutputTarget)schema_Read(src["event"]["target"], outputTargetSchema, OutputBypassRelay, &known);
+		action->event.outputMessage.value = (OutputValue)schema_Read(src["event"]["value"], outputValueSchema, OutputToggle, &known);
+	}
+
+	// LED event
+	else if(action->type == ActionEventLed)
+	{
+		// Older editors sent the index as "value" and the colour as a number
+		JsonVariantConst ledIndex = src["event"]["index"];
+		if(ledIndex.isNull())
 		{
-			preset.actions[i].event.midiMessage.channel = json["actions"][i]["event"]["channel"];
-			preset.actions[i].event.midiMessage.type = json["actions"][i]["event"]["type"];
-			preset.actions[i].event.midiMessage.data1 = json["actions"][i]["event"]["data1"];
-			preset.actions[i].event.midiMessage.data2 = json["actions"][i]["event"]["data2"];
+			ledIndex = src["event"]["value"];
 		}
-		// Expression event
-		else if(preset.actions[i].type == ActionEventExp)
+		action->event.ledMessage.index = ledIndex.as<uint16_t>();
+		JsonVariantConst ledColour = src["event"]["color"];
+		if(ledColour.is<const char*>())
 		{
-			preset.actions[i].event.expMessage.value = json["actions"][i]["event"]["value"];
+			known = schema_ParseColour(ledColour.as<const char*>(), &action->event.ledMessage.colour) && known;
 		}
-		// Output event
-		else if(preset.actions[i].type == ActionEventOutput)
+		else
 		{
-			preset.actions[i].event.outputMessage.value = json["actions"][i]["event"]["target"];
-			preset.actions[i].event.outputMessage.value = json["actions"][i]["event"]["value"];
+			action->event.ledMessage.colour = ledColour | 0;
 		}
+	}
+	return known;
+}
 
-		// LED event
-		else if(preset.actions[i].type == ActionEventLed)
-		{
-			preset.actions[i].event.ledMessage.index = json["actions"][i]["event"]["value"];
-			preset.actions[i].event.ledMessage.colour = json["actions"][i]["event"]["color"];
-		}
+// Range checks the fields that are used as indexes or sent on the wire
+bool validateAction(const Action* action)
+{
+	if(action->trigger.type > TriggerNone || action->type > ActionEventLed)
+	{
+		return false;
 	}
+	if(action->trigger.type == TriggerCC && (action->trigger.value.midiTrigger.midiNum > 127 || action->trigger.value.midiTrigger.midiValue > 127))
+	{
+		return false;
+	}
+	if(action->condition >= NUM_ACTION_CONDITIONS || action->conditionValue > 127 || action->valueOp >= NUM_ACTION_VALUE_OPS)
+	{
+		return false;
+	}
+	switch(action->type)
+	{
+		case ActionEventMidi:
+			return action->event.midiMessage.channel >= 1 && action->event.midiMessage.channel <= 16
+				&& action->event.midiMessage.data1 <= 127 && action->event.midiMessage.data2 <= 127
+				&& action->event.midiMessage.destination <= MidiDestAll;
+		case ActionEventExp:
+			return action->event.expMessage.value <= 256;
+		case ActionEventOutput:
+			return action->event.outputMessage.target <= OutputGpio && action->event.outputMessage.value <= OutputToggle;
+		case ActionEventLed:
+			return action->event.ledMessage.index < NUM_LEDS && action->event.ledMessage.colour <= 0xFFFFFF;
+	}
+	return false;
+}
 
-	// Save the preset data
-	saveCurrentPreset();
+// The preset's own fields. The wiper has 257 steps and the output states are on or off
+bool validatePreset(const Preset* preset)
+{
+	return preset->expValue <= 256
+		&& preset->switch1State <= 1 && preset->switch2State <= 1 && preset->analogSwitchState <= 1
+		&& preset->bypassRelayState <= 1 && preset->auxRelayState <= 1;
+}
 
-	// Recall the previous preset
-	globalConfig.currentPreset = currentPreset;
-	readCurrentPreset();
+// Storage compares against flash, so an unchanged record costs no erase or program
+// and a changed one only rewrites the pages of its own sector that differ. Actions
+// already in the pool are shared rather than written again.
+// A resident copy in the preset bank is refreshed so the edit applies at once
+bool writePresetRecord(uint8_t index, const Preset* record)
+{
+	if(!actionPool_StorePreset(index, record))
+	{
+		return false;
+	}
+	presetBank_Invalidate(index);
+	return true;
+}
+
+// Only a block in use can be rewritten. Every resident preset is reloaded
+// since any of them may reference it
+bool processBlockPacket(char* buffer)
+{
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+
+	// Deserialize the JSON document
+	DeserializationError error = deserializeJson(json, buffer);
+
+	// Test if parsing succeeds
+	if (error)
+	{
+		releaseJsonArena();
+		return false;
+	}
+
+	uint16_t block = json["block"] | ACTION_BLOCK_NONE;
+	Action action;
+	bool known = parseAction(json, &action);
+	releaseJsonArena();
+
+	if(!known || !validateAction(&action) || !actionPool_WriteBlock(block, &action))
+	{
+		return false;
+	}
+	for(uint8_t i=0; i<NUM_PRESETS; i++)
+	{
+		presetBank_Invalidate(i);
+	}
+	return true;
 }
 
 void sendGlobalConfigPacket()
 {
-	// Allocate the JSON document
-	// If you add custom handling, ensure you allow enough memory
-	StaticJsonDocument<100> json;
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
 	json["currentPreset"] = globalConfig.currentPreset;
 	json["midiChannel"] = globalConfig.midiChannel;
 	json["deviceName"] = globalConfig.deviceName;
 	json["hwVersion"] = HW_VERSION;
 	json["fwVersion"] = FW_VERSION;
+	json["hash"] = storage_RecordHash(StorageRecordGlobal, 0);
+	for(uint8_t i=0; i<NUM_EXP_INPUTS; i++)
+	{
+		schema_Write(json["expInputs"][i]["mode"], expInputModeSchema, globalConfig.expInputs[i].mode);
+		json["expInputs"][i]["channel"] = globalConfig.expInputs[i].channel;
+		json["expInputs"][i]["ccNumber"] = globalConfig.expInputs[i].ccNumber;
+		json["expInputs"][i]["calMin"] = globalConfig.expInputs[i].calMin;
+		json["expInputs"][i]["calMax"] = globalConfig.expInputs[i].calMax;
+	}
 	serializeJson(json, Serial);
+	Serial.println();
+	releaseJsonArena();
 }
 
 void sendPresetPacket(uint8_t presetIndex)
 {
-	// Allocate the JSON document
-	// If you add custom handling, ensure you allow enough memory
-	StaticJsonDocument<4096> json;
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+	// Send the stored preset, not the runtime state of the active one
+	Preset record;
+	actionPool_LoadPreset(presetIndex, &record);
+	// The pool block behind each action, for editing it in every preset at once
+	PresetRecord blocks;
+	actionPool_ReadRecord(presetIndex, &blocks);
+	// Colours are formatted here and copied into the arena
+	char colour[SCHEMA_COLOUR_LEN + 1];
 	json["index"] = presetIndex;
-	json["id"] = preset.id;
-	json["switch1State"] = preset.switch1State;
-	json["switch2State"] = preset.switch2State;
-	json["bypassRelayState"] = preset.bypassRelayState;
-	json["auxRelayState"] = preset.auxRelayState;
-	json["analogSwitchState"] = preset.analogSwitchState;
-	json["numActions"] = preset.numActions;
+	json["hash"] = actionPool_PresetHash(presetIndex);
+	json["id"] = record.id;
+	json["expValue"] = record.expValue;
+	json["switch1State"] = record.switch1State;
+	json["switch2State"] = record.switch2State;
+	json["bypassRelayState"] = record.bypassRelayState;
+	json["auxRelayState"] = record.auxRelayState;
+	json["analogSwitchState"] = record.analogSwitchState;
+	json["numActions"] = record.numActions;
 
 	// Process all actions
-	for(uint16_t i=0; i<preset.numActions; i++)
+	for(uint16_t i=0; i<record.numActions; i++)
 	{
+		json["actions"][i]["block"] = blocks.actions[i];
 		// Action trigger
-		json["actions"][i]["trigger"]["type"] = preset.actions[i].trigger.type;
+		schema_Write(json["actions"][i]["trigger"]["type"], triggerTypeSchema, record.actions[i].trigger.type);
 		// Button input triggers require the button state
-		if(preset.actions[i].trigger.type <= TriggerGpio7)
+		if(record.actions[i].trigger.type <= TriggerGpio7)
 		{
-			json["actions"][i]["trigger"]["value"] = preset.actions[i].trigger.value.buttonTrigger;
+			schema_Write(json["actions"][i]["trigger"]["value"], buttonStateSchema, record.actions[i].trigger.value.buttonTrigger);
 		}
 		// MIDI CC triggers require the CC number and value
-		else if(preset.actions[i].trigger.type == TriggerCC)
+		else if(record.actions[i].trigger.type == TriggerCC)
 		{
-			json["actions"][i]["trigger"]["number"] = preset.actions[i].trigger.value.midiTrigger.midiNum;
-			json["actions"][i]["trigger"]["value"]= preset.actions[i].trigger.value.midiTrigger.midiValue;
+			json["actions"][i]["trigger"]["number"] = record.actions[i].trigger.value.midiTrigger.midiNum;
+			json["actions"][i]["trigger"]["value"]= record.actions[i].trigger.value.midiTrigger.midiValue;
+		}
+		// Only actions that use them carry a condition and value operation
+		if(record.actions[i].condition != ConditionAlways)
+		{
+			schema_Write(json["actions"][i]["condition"], actionConditionSchema, record.actions[i].condition);
+			json["actions"][i]["conditionValue"] = record.actions[i].conditionValue;
+		}
+		if(record.actions[i].valueOp != ValueFixed)
+		{
+			schema_Write(json["actions"][i]["valueOp"], actionValueSchema, record.actions[i].valueOp);
 		}
 		// Action event type
-		preset.actions[i].type = json["actions"][i]["type"];
+		schema_Write(json["actions"][i]["type"], actionEventSchema, record.actions[i].type);
 
 		// Action event
 		// MIDI event
-		if(preset.actions[i].type == ActionEventMidi)
+		if(record.actions[i].type == ActionEventMidi)
 		{
-			json["actions"][i]["event"]["channel"] = preset.actions[i].event.midiMessage.channel;
-			json["actions"][i]["event"]["type"] = preset.actions[i].event.midiMessage.type;
-			json["actions"][i]["event"]["data1"] = preset.actions[i].event.midiMessage.data1;
-			json["actions"][i]["event"]["data2"] = preset.actions[i].event.midiMessage.data2;
+			json["actions"][i]["event"]["channel"] = record.actions[i].event.midiMessage.channel;
+			schema_Write(json["actions"][i]["event"]["type"], midiTypeSchema, record.actions[i].event.midiMessage.type);
+			json["actions"][i]["event"]["data1"] = record.actions[i].event.midiMessage.data1;
+			json["actions"][i]["event"]["data2"] = record.actions[i].event.midiMessage.data2;
+			schema_Write(json["actions"][i]["event"]["destination"], midiDestinationSchema, record.actions[i].event.midiMessage.destination);
 		}
 		// Expression event
-		else if(preset.actions[i].type == ActionEventExp)
+		else if(record.actions[i].type == ActionEventExp)
 		{
-			json["actions"][i]["event"]["value"] = preset.actions[i].event.expMessage.value;
+			json["actions"][i]["event"]["value"] = record.actions[i].event.expMessage.value;
 		}
 		// Output event
-		else if(preset.actions[i].type == ActionEventOutput)
+		else if(record.actions[i].type == ActionEventOutput)
 		{
-			json["actions"][i]["event"]["target"] = preset.actions[i].event.outputMessage.value;
-			json["actions"][i]["event"]["value"] = preset.actions[i].event.outputMessage.value;
+			schema_Write(json["actions"][i]["event"]["target"], outputTargetSchema, record.actions[i].event.outputMessage.target);
+			schema_Write(json["actions"][i]["event"]["value"], outputValueSchema, record.actions[i].event.outputMessage.value);
 		}
 
 		// LED event
-		else if(preset.actions[i].type == ActionEventLed)
+		else if(record.actions[i].type == ActionEventLed)
 		{
-			json["actions"][i]["event"]["value"] = preset.actions[i].event.ledMessage.index;
-			json["actions"][i]["event"]["color"] = preset.actions[i].event.ledMessage.colour;
+			json["actions"][i]["event"]["index"] = record.actions[i].event.ledMessage.index;
+			schema_FormatColour(record.actions[i].event.ledMessage.colour, colour);
+			json["actions"][i]["event"]["color"] = colour;
 		}
 	}
 	
 	serializeJson(json, Serial);
-}
\ No newline at end of file
+	Serial.println();
+	releaseJsonArena();
+}
+void sendMidiStatsPacket()
+{
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+	const char* portNames[NUM_MIDI_PORTS] = {"trs", "usb"};
+	for(uint8_t i=0; i<NUM_MIDI_PORTS; i++)
+	{
+		const MidiOutStats* stats = midiOut_GetStats((MidiPort)i);
+		json[portNames[i]]["queued"] = stats->queued;
+		json[portNames[i]]["sent"] = stats->sent;
+		json[portNames[i]]["coalesced"] = stats->coalesced;
+		json[portNames[i]]["dropped"] = stats->dropped;
+		json[portNames[i]]["runningStatusSaved"] = stats->runningStatusSaved;
+		json[portNames[i]]["highWater"] = stats->highWater;
+		json[portNames[i]]["batches"] = stats->batches;
+		json[portNames[i]]["sysExBytes"] = stats->sysExBytes;
+	}
+	serializeJson(json, Serial);
+	Serial.println();
+	releaseJsonArena();
+}
+
+void sendMemoryPacket()
+{
+	MemStats stats;
+	memStats_Get(&stats);
+
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+	json["data"] = stats.dataSize;
+	json["bss"] = stats.bssSize;
+	json["heap"]["size"] = stats.heapSize;
+	json["heap"]["arena"] = stats.heapArena;
+	json["heap"]["used"] = stats.heapUsed;
+	json["heap"]["free"] = stats.heapFree;
+	for(uint8_t i=0; i<MEM_NUM_CORES; i++)
+	{
+		json["stacks"][i]["size"] = stats.stacks[i].size;
+		json["stacks"][i]["highWater"] = stats.stacks[i].highWater;
+	}
+	json["jsonArena"]["size"] = stats.jsonArenaSize;
+	json["jsonArena"]["peak"] = stats.jsonArenaPeak;
+	json["jsonArena"]["overflows"] = stats.jsonArenaOverflows;
+	const SerialRxStats* rx = serialRx_GetStats();
+	json["serialRx"]["frameSize"] = JSON_RX_BUFFER_SIZE;
+	json["serialRx"]["ringSize"] = SERIAL_RX_RING_SIZE;
+	json["serialRx"]["ringHighWater"] = rx->ringHighWater;
+	json["serialRx"]["frames"] = rx->frames;
+	json["serialRx"]["idleFrames"] = rx->idleFrames;
+	json["serialRx"]["oversized"] = rx->oversized;
+	serializeJson(json, Serial);
+	Serial.println();
+	releaseJsonArena();
+}
+
+void sendManifestPacket()
+{
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+	json["global"] = storage_RecordHash(StorageRecordGlobal, 0);
+	JsonArray presets = json.createNestedArray("presets");
+	for(uint8_t i=0; i<NUM_PRESETS; i++)
+	{
+		presets.add(actionPool_PresetHash(i));
+	}
+	serializeJson(json, Serial);
+	Serial.println();
+	releaseJsonArena();
+}
+
+void sendPoolStatsPacket()
+{
+	const ActionPoolStats* stats = actionPool_GetStats();
+
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+	json["size"] = ACTION_POOL_SIZE;
+	json["used"] = stats->used;
+	json["shared"] = stats->shared;
+	json["references"] = stats->references;
+	json["reclaimed"] = stats->reclaimed;
+	json["poolFull"] = stats->poolFull;
+	serializeJson(json, Serial);
+	Serial.println();
+	releaseJsonArena();
+}
+
+// The projection assumes the hottest sector keeps wearing at its rate since boot
+void sendFlashStatsPacket()
+{
+	const StorageStats* stats = storage_GetStats();
+
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+	json["flushes"] = stats->flushes;
+	json["erases"] = stats->erases;
+	json["pagePrograms"] = stats->pagePrograms;
+	json["bytesProgrammed"] = stats->bytesProgrammed;
+	json["blockedMs"] = (uint32_t)(stats->blockedUs / 1000);
+	json["maxBlockedUs"] = stats->maxBlockedUs;
+	json["maxWorstCaseUs"] = stats->maxWorstCaseUs;
+	json["hottestSector"] = stats->hottestSector;
+	json["hottestErases"] = stats->hottestErases;
+	json["enduranceCycles"] = STORAGE_ENDURANCE_CYCLES;
+	if(stats->hottestErases)
+	{
+		json["projectedHours"] = ((float)STORAGE_ENDURANCE_CYCLES / stats->hottestErases) * (millis() / 3600000.0f);
+	}
+	json["uptimeMs"] = millis();
+	serializeJson(json, Serial);
+	Serial.println();
+	releaseJsonArena();
+}
+
+void sendLoopStatsPacket()
+{
+	const ControlTickStats* stats = controlTick_GetStats();
+
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+	json["tickUs"] = CONTROL_TICK_US;
+	json["ticks"] = stats->ticks;
+	json["overruns"] = stats->overruns;
+	json["maxLateUs"] = stats->maxLateUs;
+	json["maxTickUs"] = stats->maxTickUs;
+	json["sleeps"] = stats->sleeps;
+	json["sleptMs"] = (uint32_t)(stats->sleptUs / 1000);
+	json["uptimeMs"] = millis();
+	const OutputSeqStats* outputs = outputSeq_GetStats();
+	json["outputs"]["immediate"] = outputs->immediate;
+	json["outputs"]["transitions"] = outputs->transitions;
+	json["outputs"]["deferred"] = outputs->deferred;
+	json["outputs"]["maxTransitionUs"] = outputs->maxTransitionUs;
+	serializeJson(json, Serial);
+	Serial.println();
+	releaseJsonArena();
+}
+
+#ifdef PICOMOD_TRACE
+void sendTracePacket()
+{
+	// Use the shared JSON arena
+	// If you add custom handling, ensure JSON_ARENA_SIZE allows enough memory
+	JsonDocument& json = acquireJsonArena();
+	for(uint8_t i=0; i<NUM_TRACE_PATHS; i++)
+	{
+		const TraceHistogram* hist = trace_GetHistogram((TracePath)i);
+		json["paths"][i]["name"] = trace_PathName((TracePath)i);
+		json["paths"][i]["count"] = hist->count;
+		json["paths"][i]["min"] = hist->min;
+		json["paths"][i]["avg"] = hist->count ? (uint32_t)(hist->sum / hist->count) : 0;
+		json["paths"][i]["max"] = hist->max;
+		json["paths"][i]["p99"] = trace_Percentile((TracePath)i, 99);
+	}
+	// Most recent entries as [path, timestamp, duration]
+	TraceEntry entries[32];
+	uint16_t count = trace_ReadRecent(entries, 32);
+	for(uint16_t i=0; i<count; i++)
+	{
+		json["recent"][i][0] = entries[i].path;
+		json["recent"][i][1] = entries[i].timestamp;
+		json["recent"][i][2] = entries[i].duration;
+	}
+	serializeJson(json, Serial);
+	Serial.println();
+	releaseJsonArena();
+}
+#endif
@@ -0,0 +1,126 @@
+#include "presetbank.h"
+#include "actionpool.h"
+
+static PresetSlot slots[PRESET_BANK_SLOTS];
+static const PresetSlot* activeSlot = NULL;
+static bool prefetchPending = false;
+
+// Private Function Prototypes
+static PresetSlot* findSlot(uint8_t index);
+static PresetSlot* claimSlot(uint8_t active);
+static void loadSlot(PresetSlot* slot, uint8_t index);
+
+
+//------------------ System ------------------//
+// Fills the whole window before the first preset is used
+void presetBank_Init(uint8_t index)
+{
+	for(uint8_t i=0; i<PRESET_BANK_SLOTS; i++)
+	{
+		slots[i].valid = false;
+	}
+	activeSlot = presetBank_Select(index);
+	presetBank_Process();
+}
+
+// Constant time when the preset is resident, otherwise it is loaded in place of
+// the slot furthest from the window. The neighbours are fetched by presetBank_Process()
+const PresetSlot* presetBank_Select(uint8_t index)
+{
+	PresetSlot* slot = findSlot(index);
+	if(slot == NULL)
+	{
+		slot = claimSlot(index);
+		loadSlot(slot, index);
+	}
+	activeSlot = slot;
+	prefetchPending = true;
+	return slot;
+}
+
+// Called from the main loop, away from the switching path
+void presetBank_Process()
+{
+	if(!prefetchPending || activeSlot == NULL)
+	{
+		return;
+	}
+	prefetchPending = false;
+	uint8_t active = activeSlot->index;
+	uint8_t neighbours[2] = {presetBank_Next(active), presetBank_Previous(active)};
+	for(uint8_t i=0; i<2; i++)
+	{
+		if(findSlot(neighbours[i]) == NULL)
+		{
+			loadSlot(claimSlot(active), neighbours[i]);
+		}
+	}
+}
+
+// Reloads a resident preset after its record has been written
+void presetBank_Invalidate(uint8_t index)
+{
+	PresetSlot* slot = findSlot(index);
+	if(slot)
+	{
+		loadSlot(slot, index);
+	}
+}
+
+uint8_t presetBank_Next(uint8_t index)
+{
+	return index + 1 >= NUM_PRESETS ? 0 : index + 1;
+}
+
+uint8_t presetBank_Previous(uint8_t index)
+{
+	return index == 0 ? NUM_PRESETS - 1 : index - 1;
+}
+
+
+//-------------------- Local Functions --------------------//
+static PresetSlot* findSlot(uint8_t index)
+{
+	for(uint8_t i=0; i<PRESET_BANK_SLOTS; i++)
+	{
+		if(slots[i].valid && slots[i].index == index)
+		{
+			return &slots[i];
+		}
+	}
+	return NULL;
+}
+
+// Picks a slot outside the window around the active preset
+static PresetSlot* claimSlot(uint8_t active)
+{
+	uint8_t next = presetBank_Next(active);
+	uint8_t previous = presetBank_Previous(active);
+	for(uint8_t i=0; i<PRESET_BANK_SLOTS; i++)
+	{
+		if(!slots[i].valid)
+		{
+			return &slots[i];
+		}
+	}
+	for(uint8_t i=0; i<PRESET_BANK_SLOTS; i++)
+	{
+		uint8_t index = slots[i].index;
+		if(&slots[i] != activeSlot && index != active && index != next && index != previous)
+		{
+			return &slots[i];
+		}
+	}
+	// Every slot is in the window, give up the previous preset first
+	PresetSlot* slot = findSlot(previous);
+	return slot && slot != activeSlot ? slot : findSlot(next);
+}
+
+// Resolves the record's action blocks out of flash and compiles them
+static void loadSlot(PresetSlot* slot, uint8_t index)
+{
+	actionPool_LoadPreset(index, &slot->preset);
+	actionCode_Compile(&slot->preset, &slot->program);
+	slot->index = index;
+	slot->valid = true;
+}
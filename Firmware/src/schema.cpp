@@ -0,0 +1,64 @@
+#include "schema.h"
+
+// Private Function Prototypes
+static int8_t hexNibble(char c);
+
+
+//------------------ Colours ------------------//
+// Parses "rrggbb" or "#rrggbb" into 0x00rrggbb. Returns false for anything else
+bool schema_ParseColour(const char* str, uint32_t* colour)
+{
+	if(str == NULL)
+	{
+		return false;
+	}
+	if(*str == '#')
+	{
+		str++;
+	}
+	uint32_t value = 0;
+	for(uint8_t i=0; i<SCHEMA_COLOUR_LEN; i++)
+	{
+		int8_t nibble = hexNibble(str[i]);
+		if(nibble < 0)
+		{
+			return false;
+		}
+		value = (value << 4) | nibble;
+	}
+	if(str[SCHEMA_COLOUR_LEN] != 0)
+	{
+		return false;
+	}
+	*colour = value;
+	return true;
+}
+
+// str must have at least SCHEMA_COLOUR_LEN + 1 allocated
+void schema_FormatColour(uint32_t colour, char* str)
+{
+	static const char digits[] = "0123456789abcdef";
+	for(int8_t i=SCHEMA_COLOUR_LEN-1; i>=0; i--)
+	{
+		str[i] = digits[colour & 0xF];
+		colour >>= 4;
+	}
+	str[SCHEMA_COLOUR_LEN] = 0;
+}
+
+
+//-------------------- Local Functions --------------------//
+static int8_t hexNibble(char c)
+{
+	if(c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	// Fold to lower case
+	c |= 0x20;
+	if(c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	return -1;
+}
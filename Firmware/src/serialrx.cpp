@@ -0,0 +1,141 @@
+#include "picomod.h"
+#include "serialrx.h"
+
+static_assert((SERIAL_RX_RING_SIZE & (SERIAL_RX_RING_SIZE - 1)) == 0, "Ring size must be a power of two");
+
+static uint8_t ring[SERIAL_RX_RING_SIZE];
+static uint16_t ringHead;
+static uint16_t ringCount;
+static uint32_t lastRxMs;
+
+// Frames are assembled here and parsed in place
+static char frame[JSON_RX_BUFFER_SIZE];
+static uint16_t frameLen;
+static bool discarding;			// The current frame overflowed and is skipped up to its end
+
+static SerialRxStats stats;
+
+// Private Function Prototypes
+static void fillRing();
+static bool assembleFrame();
+static void discardFrame();
+
+
+//------------------ System ------------------//
+void serialRx_Init()
+{
+	ringHead = 0;
+	ringCount = 0;
+	frameLen = 0;
+	discarding = false;
+	memset(&stats, 0, sizeof(SerialRxStats));
+}
+
+// Takes whatever the CDC has received and dispatches complete frames
+void serialRx_Process()
+{
+	fillRing();
+	for(uint8_t i=0; i<SERIAL_RX_FRAMES_PER_CALL; i++)
+	{
+		if(!assembleFrame())
+		{
+			return;
+		}
+		uint16_t len = frameLen;
+		frameLen = 0;
+		stats.frames++;
+		picoMod_SerialRx(frame, len);
+	}
+}
+
+// Received bytes are waiting to be framed. A partial frame waiting on more
+// bytes or its idle timeout is not pending work
+bool serialRx_Pending()
+{
+	return ringCount || Serial.available() > 0;
+}
+
+const SerialRxStats* serialRx_GetStats()
+{
+	return &stats;
+}
+
+
+//-------------------- Local Functions --------------------//
+static void fillRing()
+{
+	int available = Serial.available();
+	if(available <= 0)
+	{
+		return;
+	}
+	while(available-- > 0 && ringCount < SERIAL_RX_RING_SIZE)
+	{
+		ring[(ringHead + ringCount) & (SERIAL_RX_RING_SIZE - 1)] = Serial.read();
+		ringCount++;
+	}
+	if(ringCount > stats.ringHighWater)
+	{
+		stats.ringHighWater = ringCount;
+	}
+	lastRxMs = millis();
+}
+
+// Moves bytes from the ring into the frame until a frame is complete.
+// Carriage returns and empty lines are ignored
+static bool assembleFrame()
+{
+	while(ringCount)
+	{
+		char c = ring[ringHead];
+		ringHead = (ringHead + 1) & (SERIAL_RX_RING_SIZE - 1);
+		ringCount--;
+
+		if(c == '\n')
+		{
+			if(discarding)
+			{
+				discardFrame();
+			}
+			else if(frameLen)
+			{
+				frame[frameLen] = 0;
+				return true;
+			}
+		}
+		else if(c != '\r' && !discarding)
+		{
+			if(frameLen >= JSON_RX_BUFFER_SIZE - 1)
+			{
+				discarding = true;
+			}
+			else
+			{
+				frame[frameLen++] = c;
+			}
+		}
+	}
+
+	// Nothing more has arrived for a while, the sender does not terminate its frames
+	if(frameLen && (millis() - lastRxMs) >= SERIAL_RX_IDLE_MS)
+	{
+		if(discarding)
+		{
+			discardFrame();
+			return false;
+		}
+		frame[frameLen] = 0;
+		stats.idleFrames++;
+		return true;
+	}
+	return false;
+}
+
+// An oversized frame still gets its one reply so pipelined responses stay in step
+static void discardFrame()
+{
+	discarding = false;
+	frameLen = 0;
+	stats.oversized++;
+	Serial.println("error");
+}
@@ -0,0 +1,381 @@
+#include "picomod.h"
+#include "storage.h"
+#include "actionpool.h"
+#include "hardware/flash.h"
+
+// Flash region from the linker script. The host build has no linker script
+// so host/src/hal.cpp provides an erased stand-in region instead
+#ifdef PICOMOD_HOST
+#include "host.h"
+#define STORAGE_REGION_START	host_MemorySymbol("_FS_start")
+#define STORAGE_REGION_END		host_MemorySymbol("_FS_end")
+#else
+extern "C" uint8_t _FS_start[], _FS_end[];
+#define STORAGE_REGION_START	((uintptr_t)_FS_start)
+#define STORAGE_REGION_END		((uintptr_t)_FS_end)
+#endif
+
+// Whole sectors holding count records of one type, packed so that none straddles
+// a sector boundary. Areas follow one another, each starting where the last ends
+template<typename Record, size_t Count, size_t FirstSector>
+struct StorageArea
+{
+	static_assert(sizeof(Record) <= STORAGE_SECTOR_SIZE, "A record must fit in one sector");
+	static constexpr size_t perSector = STORAGE_SECTOR_SIZE / sizeof(Record);
+	static constexpr size_t endSector = FirstSector + (Count + perSector - 1) / perSector;
+
+	static constexpr uint32_t offset(uint16_t index)
+	{
+		return (FirstSector + index / perSector) * STORAGE_SECTOR_SIZE + (index % perSector) * sizeof(Record);
+	}
+};
+
+// The global config has sector 0 to itself, then the preset records, the action pool
+// blocks and the current preset log, one byte per entry
+typedef StorageArea<GlobalConfig, 1, 0> GlobalArea;
+typedef StorageArea<PresetRecord, NUM_PRESETS, GlobalArea::endSector> PresetArea;
+typedef StorageArea<Action, ACTION_POOL_SIZE, PresetArea::endSector> ActionArea;
+typedef StorageArea<uint8_t, STORAGE_SECTOR_SIZE, ActionArea::endSector> PresetLogArea;
+#define STORAGE_NUM_SECTORS		PresetLogArea::endSector
+#define STORAGE_LOG_SECTOR			ActionArea::endSector
+#define STORAGE_LOG_FREE			0xFF		// Erased, never written
+
+static_assert(STORAGE_NUM_SECTORS * STORAGE_SECTOR_SIZE <= STORAGE_REGION_SIZE, "Records do not fit in board_build.filesystem_size");
+static_assert(PresetArea::offset(NUM_PRESETS - 1) + sizeof(PresetRecord) <= ActionArea::offset(0), "Preset records overlap the action pool");
+static_assert(NUM_PRESETS <= STORAGE_LOG_FREE, "Every preset index must differ from a free log entry");
+
+typedef struct
+{
+	int16_t sector;				// -1 when the slot is free
+	bool dirty;
+	uint32_t lastUse;
+	uint8_t data[STORAGE_SECTOR_SIZE] __attribute__((aligned(4)));
+} StorageSector;
+
+static StorageSector cache[STORAGE_CACHE_SECTORS];
+static uint32_t useCounter;
+
+// Presets are hashed by content in the action pool, only the global config is kept here
+static uint32_t globalHash;
+
+// First free entry of the current preset log
+static uint16_t logNext;
+
+static StorageStats stats;
+static uint32_t sectorErases[STORAGE_NUM_SECTORS];
+
+// Private Function Prototypes
+static const uint8_t* sectorAddress(uint16_t sector);
+static StorageSector* findSector(uint16_t sector);
+static StorageSector* loadSector(uint16_t sector);
+static void flushSector(StorageSector* slot);
+static bool validRecord(StorageRecordType type, uint16_t index);
+static const uint8_t* logEntries();
+
+
+//------------------ System ------------------//
+void storage_Init()
+{
+	for(uint8_t i=0; i<STORAGE_CACHE_SECTORS; i++)
+	{
+		cache[i].sector = -1;
+		cache[i].dirty = false;
+	}
+	if(STORAGE_REGION_END - STORAGE_REGION_START < STORAGE_NUM_SECTORS * STORAGE_SECTOR_SIZE)
+	{
+		Serial.println("Storage region too small, check board_build.filesystem_size");
+		return;
+	}
+	globalHash = storage_Hash(sectorAddress(0), sizeof(GlobalConfig));
+	// Entries are appended in order, the newest is the last one written
+	const uint8_t* log = logEntries();
+	logNext = STORAGE_SECTOR_SIZE;
+	while(logNext > 0 && log[logNext - 1] == STORAGE_LOG_FREE)
+	{
+		logNext--;
+	}
+}
+
+// Byte offset of a record from the start of the storage region
+uint32_t storage_RecordOffset(StorageRecordType type, uint16_t index)
+{
+	switch(type)
+	{
+		case StorageRecordPreset:
+		return PresetArea::offset(index);
+
+		case StorageRecordAction:
+		return ActionArea::offset(index);
+
+		default:
+		return GlobalArea::offset(0);
+	}
+}
+
+// Staged writes are returned before they are committed
+bool storage_Read(StorageRecordType type, uint16_t index, void* data, size_t size)
+{
+	if(!validRecord(type, index))
+	{
+		return false;
+	}
+	uint32_t offset = storage_RecordOffset(type, index);
+	uint16_t sector = offset / STORAGE_SECTOR_SIZE;
+	StorageSector* slot = findSector(sector);
+	const uint8_t* source = slot ? slot->data : sectorAddress(sector);
+	memcpy(data, source + offset % STORAGE_SECTOR_SIZE, size);
+	return true;
+}
+
+// Stages a record. Nothing is buffered if the stored record already matches
+bool storage_Write(StorageRecordType type, uint16_t index, const void* data, size_t size)
+{
+	if(!validRecord(type, index))
+	{
+		return false;
+	}
+	uint32_t offset = storage_RecordOffset(type, index);
+	uint16_t sector = offset / STORAGE_SECTOR_SIZE;
+	offset %= STORAGE_SECTOR_SIZE;
+
+	StorageSector* slot = findSector(sector);
+	const uint8_t* current = slot ? slot->data : sectorAddress(sector);
+	if(memcmp(current + offset, data, size) == 0)
+	{
+		return true;
+	}
+	if(slot == NULL)
+	{
+		slot = loadSector(sector);
+	}
+	memcpy(slot->data + offset, data, size);
+	slot->dirty = true;
+	if(type == StorageRecordGlobal)
+	{
+		globalHash = storage_Hash(data, size);
+	}
+	return true;
+}
+
+// Opaque, only meaningful compared with an earlier hash of the same record.
+// Covers the staged record, so it is current before the commit
+uint32_t storage_RecordHash(StorageRecordType type, uint16_t index)
+{
+	return (type == StorageRecordGlobal && validRecord(type, index)) ? globalHash : 0;
+}
+
+// FNV-1a. Pass the previous result as the basis to continue a hash over more data
+uint32_t storage_Hash(const void* data, size_t size, uint32_t hash)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for(size_t i=0; i<size; i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// Returns false while the log is empty
+bool storage_ReadCurrentPreset(uint8_t* index)
+{
+	if(logNext == 0)
+	{
+		return false;
+	}
+	*index = logEntries()[logNext - 1];
+	return true;
+}
+
+// Stages one more log entry, which only clears bits of the sector until it is full
+void storage_WriteCurrentPreset(uint8_t index)
+{
+	uint8_t current;
+	if(storage_ReadCurrentPreset(&current) && current == index)
+	{
+		return;
+	}
+	if(logNext >= STORAGE_SECTOR_SIZE)
+	{
+		storage_ResetCurrentPreset(index);
+		return;
+	}
+	StorageSector* slot = findSector(STORAGE_LOG_SECTOR);
+	if(slot == NULL)
+	{
+		slot = loadSector(STORAGE_LOG_SECTOR);
+	}
+	slot->data[logNext++] = index;
+	slot->dirty = true;
+}
+
+// Starts the log over with index as its only entry, the sector is erased on commit
+void storage_ResetCurrentPreset(uint8_t index)
+{
+	StorageSector* slot = findSector(STORAGE_LOG_SECTOR);
+	if(slot == NULL)
+	{
+		slot = loadSector(STORAGE_LOG_SECTOR);
+	}
+	memset(slot->data, STORAGE_LOG_FREE, STORAGE_SECTOR_SIZE);
+	slot->data[0] = index;
+	logNext = 1;
+	slot->dirty = true;
+}
+
+// The hottest sector is found when asked for
+const StorageStats* storage_GetStats()
+{
+	stats.hottestSector = 0;
+	for(uint16_t i=1; i<STORAGE_NUM_SECTORS; i++)
+	{
+		if(sectorErases[i] > sectorErases[stats.hottestSector])
+		{
+			stats.hottestSector = i;
+		}
+	}
+	stats.hottestErases = sectorErases[stats.hottestSector];
+	return &stats;
+}
+
+void storage_ResetStats()
+{
+	memset(&stats, 0, sizeof(StorageStats));
+	memset(sectorErases, 0, sizeof(sectorErases));
+}
+
+void storage_Commit()
+{
+	for(uint8_t i=0; i<STORAGE_CACHE_SECTORS; i++)
+	{
+		if(cache[i].dirty)
+		{
+			flushSector(&cache[i]);
+		}
+	}
+}
+
+
+//-------------------- Local Functions --------------------//
+static const uint8_t* sectorAddress(uint16_t sector)
+{
+	return (const uint8_t*)(STORAGE_REGION_START + sector * STORAGE_SECTOR_SIZE);
+}
+
+// The staged log when there is one, so entries are current before the commit
+static const uint8_t* logEntries()
+{
+	StorageSector* slot = findSector(STORAGE_LOG_SECTOR);
+	return slot ? slot->data : sectorAddress(STORAGE_LOG_SECTOR);
+}
+
+static StorageSector* findSector(uint16_t sector)
+{
+	for(uint8_t i=0; i<STORAGE_CACHE_SECTORS; i++)
+	{
+		if(cache[i].sector == sector)
+		{
+			cache[i].lastUse = ++useCounter;
+			return &cache[i];
+		}
+	}
+	return NULL;
+}
+
+// Claims a free slot, or the least recently used one after flushing it
+static StorageSector* loadSector(uint16_t sector)
+{
+	StorageSector* slot = &cache[0];
+	for(uint8_t i=0; i<STORAGE_CACHE_SECTORS; i++)
+	{
+		if(cache[i].sector < 0)
+		{
+			slot = &cache[i];
+			break;
+		}
+		if(cache[i].lastUse < slot->lastUse)
+		{
+			slot = &cache[i];
+		}
+	}
+	if(slot->dirty)
+	{
+		flushSector(slot);
+	}
+	memcpy(slot->data, sectorAddress(sector), STORAGE_SECTOR_SIZE);
+	slot->sector = sector;
+	slot->lastUse = ++useCounter;
+	return slot;
+}
+
+// Programming only clears bits, so the sector is erased only if a bit has to go from 0 to 1.
+// Without an erase just the pages that differ are programmed, after one every page that is not blank
+static void flushSector(StorageSector* slot)
+{
+	const uint8_t* flash = sectorAddress(slot->sector);
+	bool erase = false;
+	for(uint16_t i=0; i<STORAGE_SECTOR_SIZE && !erase; i++)
+	{
+		erase = (flash[i] & slot->data[i]) != slot->data[i];
+	}
+
+	uint32_t flashOffset = (uintptr_t)flash - XIP_BASE;
+	TRACE_BEGIN(commitStart);
+	uint64_t blockedStart = time_us_64();
+	// Flash is unavailable to XIP while it is written, nothing may run from it meanwhile
+	rp2040.idleOtherCore();
+	noInterrupts();
+	uint32_t worstCaseUs = 0;
+	if(erase)
+	{
+		flash_range_erase(flashOffset, STORAGE_SECTOR_SIZE);
+		stats.erases++;
+		sectorErases[slot->sector]++;
+		worstCaseUs += STORAGE_ERASE_WORST_US;
+	}
+	for(uint16_t page=0; page<STORAGE_SECTOR_SIZE; page+=STORAGE_PAGE_SIZE)
+	{
+		bool program = false;
+		for(uint16_t i=page; i<page+STORAGE_PAGE_SIZE && !program; i++)
+		{
+			program = erase ? slot->data[i] != 0xFF : slot->data[i] != flash[i];
+		}
+		if(program)
+		{
+			flash_range_program(flashOffset + page, slot->data + page, STORAGE_PAGE_SIZE);
+			stats.pagePrograms++;
+			stats.bytesProgrammed += STORAGE_PAGE_SIZE;
+			worstCaseUs += STORAGE_PROGRAM_WORST_US;
+		}
+	}
+	interrupts();
+	rp2040.resumeOtherCore();
+	TRACE_END(TracePathFlashCommit, commitStart);
+	uint32_t blockedUs = time_us_64() - blockedStart;
+	stats.flushes++;
+	stats.blockedUs += blockedUs;
+	if(blockedUs > stats.maxBlockedUs)
+	{
+		stats.maxBlockedUs = blockedUs;
+	}
+	if(worstCaseUs > stats.maxWorstCaseUs)
+	{
+		stats.maxWorstCaseUs = worstCaseUs;
+	}
+	slot->dirty = false;
+}
+
+static bool validRecord(StorageRecordType type, uint16_t index)
+{
+	switch(type)
+	{
+		case StorageRecordGlobal:
+		return index == 0;
+
+		case StorageRecordPreset:
+		return index < NUM_PRESETS;
+
+		case StorageRecordAction:
+		return index < ACTION_POOL_SIZE;
+	}
+	return false;
+}
@@ -0,0 +1,234 @@
+#include "trace.h"
+#include "hardware/sync.h"
+
+#ifdef PICOMOD_TRACE
+
+static TraceHistogram histograms[NUM_TRACE_PATHS];
+static TraceEntry ring[TRACE_RING_SIZE];
+static volatile uint32_t ringHead;
+
+static volatile uint32_t inputEdgeUs[TRACE_NUM_INPUTS];
+static volatile uint32_t dispatchOriginUs;
+static uint8_t dispatchDepth;
+
+static const char* pathNames[NUM_TRACE_PATHS] =
+{
+	"switchEdge",
+	"triggers",
+	"actionMidi",
+	"actionExp",
+	"actionOutput",
+	"actionLed",
+	"presetChange",
+	"flashCommit",
+	"edgeToRelay",
+	"edgeToDigipot",
+	"edgeToMidiTrs",
+	"edgeToMidiUsb",
+	"edgeToAnalogSwitch"
+};
+
+// Private Function Prototypes
+static uint8_t bucketIndex(uint32_t value);
+static uint32_t bucketLowerBound(uint8_t index);
+
+
+//------------------ Recording ------------------//
+// Can be called from interrupt context (the buttons library may dispatch from its timer).
+// Interrupts are masked for the few dozen cycles of the update so the histogram stays
+// consistent, the ring is read back without any locking using the entry sequence numbers
+void trace_Record(TracePath path, uint32_t startUs, uint32_t endUs)
+{
+	uint32_t duration = endUs - startUs;
+	uint32_t irqState = save_and_disable_interrupts();
+
+	TraceHistogram* hist = &histograms[path];
+	if(hist->count == 0 || duration < hist->min)
+	{
+		hist->min = duration;
+	}
+	if(duration > hist->max)
+	{
+		hist->max = duration;
+	}
+	hist->count++;
+	hist->sum += duration;
+	hist->buckets[bucketIndex(duration)]++;
+
+	uint32_t index = ringHead;
+	TraceEntry* entry = &ring[index & (TRACE_RING_SIZE - 1)];
+	entry->sequence = 0;
+	entry->timestamp = endUs;
+	entry->duration = duration;
+	entry->path = path;
+	entry->sequence = index + 1;
+	ringHead = index + 1;
+
+	restore_interrupts(irqState);
+}
+
+// Called from the GPIO ISR, only stores the edge time
+void trace_InputEdge(uint8_t input)
+{
+	if(input < TRACE_NUM_INPUTS)
+	{
+		inputEdgeUs[input] = time_us_32();
+	}
+}
+
+uint32_t trace_InputEdgeTime(uint8_t input)
+{
+	if(input >= TRACE_NUM_INPUTS)
+	{
+		return 0;
+	}
+	return inputEdgeUs[input];
+}
+
+// Outputs completed while a dispatch is open are measured against its origin.
+// Nested dispatches (e.g. bank exit/entry triggers inside a preset change) keep the outer origin
+void trace_BeginDispatch(uint32_t originUs)
+{
+	if(dispatchDepth++ == 0)
+	{
+		// 0 is reserved for "no origin"
+		dispatchOriginUs = originUs ? originUs : 1;
+	}
+}
+
+// Starts a dispatch caused by an input edge, recording the edge to dispatch latency
+void trace_BeginInputDispatch(uint8_t input)
+{
+	uint32_t edgeUs = trace_InputEdgeTime(input);
+	trace_Record(TracePathSwitchEdge, edgeUs, time_us_32());
+	trace_BeginDispatch(edgeUs);
+}
+
+void trace_EndDispatch()
+{
+	if(dispatchDepth && --dispatchDepth == 0)
+	{
+		dispatchOriginUs = 0;
+	}
+}
+
+uint32_t trace_Origin()
+{
+	return dispatchOriginUs;
+}
+
+void trace_Output(TracePath path)
+{
+	trace_OutputFrom(path, dispatchOriginUs);
+}
+
+void trace_OutputFrom(TracePath path, uint32_t originUs)
+{
+	if(originUs)
+	{
+		trace_Record(path, originUs, time_us_32());
+	}
+}
+
+
+//------------------ Reporting ------------------//
+void trace_Reset()
+{
+	uint32_t irqState = save_and_disable_interrupts();
+	memset(histograms, 0, sizeof(histograms));
+	memset(ring, 0, sizeof(ring));
+	ringHead = 0;
+	restore_interrupts(irqState);
+}
+
+const TraceHistogram* trace_GetHistogram(TracePath path)
+{
+	if(path >= NUM_TRACE_PATHS)
+	{
+		return NULL;
+	}
+	return &histograms[path];
+}
+
+// Returns the upper bound of the bucket holding the requested percentile, clamped to the max seen
+uint32_t trace_Percentile(TracePath path, uint8_t percentile)
+{
+	TraceHistogram* hist = &histograms[path];
+	if(hist->count == 0)
+	{
+		return 0;
+	}
+	uint32_t target = ((uint64_t)hist->count * percentile + 99) / 100;
+	uint32_t seen = 0;
+	for(uint8_t i=0; i<TRACE_HIST_BUCKETS; i++)
+	{
+		seen += hist->buckets[i];
+		if(seen >= target)
+		{
+			if(i == TRACE_HIST_BUCKETS - 1)
+			{
+				return hist->max;
+			}
+			uint32_t upper = bucketLowerBound(i + 1) - 1;
+			return upper < hist->max ? upper : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+// Copies the most recent entries, oldest first. Entries overwritten during the copy are skipped
+uint16_t trace_ReadRecent(TraceEntry* entries, uint16_t maxEntries)
+{
+	uint32_t head = ringHead;
+	uint32_t available = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+	if(available > maxEntries)
+	{
+		available = maxEntries;
+	}
+	uint16_t count = 0;
+	for(uint32_t index = head - available; index != head; index++)
+	{
+		TraceEntry* entry = &ring[index & (TRACE_RING_SIZE - 1)];
+		uint32_t sequence = entry->sequence;
+		entries[count] = *entry;
+		if(sequence == index + 1 && entry->sequence == sequence)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+const char* trace_PathName(TracePath path)
+{
+	if(path >= NUM_TRACE_PATHS)
+	{
+		return "";
+	}
+	return pathNames[path];
+}
+
+
+//-------------------- Local Functions --------------------//
+// Log-linear buckets, 4 per power of two. Values 0-3 map directly
+static uint8_t bucketIndex(uint32_t value)
+{
+	if(value < 4)
+	{
+		return value;
+	}
+	uint8_t msb = 31 - __builtin_clz(value);
+	uint8_t index = (msb - 1) * 4 + ((value >> (msb - 2)) & 3);
+	return index < TRACE_HIST_BUCKETS ? index : TRACE_HIST_BUCKETS - 1;
+}
+
+static uint32_t bucketLowerBound(uint8_t index)
+{
+	if(index < 4)
+	{
+		return index;
+	}
+	return (uint32_t)(4 + (index & 3)) << (index / 4 - 1);
+}
+
+#endif /* PICOMOD_TRACE */